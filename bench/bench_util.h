@@ -0,0 +1,49 @@
+// Small helpers shared by the benchmark programs: a monotonic clock and a
+// JSON line emitter, so results can be collected and compared across runs.
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace bench {
+
+inline double now_sec() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// percentile of a sample set (p in 0..100); sorts a copy
+inline double percentile(std::vector<double> v, double p) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    size_t idx = (size_t)(p / 100.0 * (v.size() - 1) + 0.5);
+    return v[std::min(idx, v.size() - 1)];
+}
+
+// One JSON object per line: {"bench":"name","key":value,...}
+class Result {
+public:
+    explicit Result(const std::string &name) { out_ = "{\"bench\":\"" + name + "\""; }
+
+    Result &num(const std::string &key, double v) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.6g", v);
+        out_ += ",\"" + key + "\":" + buf;
+        return *this;
+    }
+
+    Result &str(const std::string &key, const std::string &v) {
+        out_ += ",\"" + key + "\":\"" + v + "\"";
+        return *this;
+    }
+
+    void emit() const { printf("%s}\n", out_.c_str()); fflush(stdout); }
+
+private:
+    std::string out_;
+};
+
+} // namespace bench
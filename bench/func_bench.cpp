@@ -0,0 +1,50 @@
+// Shell functions: cost of one call, in-process vs a helper script.
+//
+//   make bench
+//   ./func_bench [calls]
+//
+// function        - "f" where f() { :; }, run in the shell (no fork)
+// function_local  - "g a b" where g() { local v=$1; :; } (positional params + a local frame)
+// script          - "sh helper.sh", the same body as a separate script (fork + exec)
+// Output is one JSON line per case with the mean cost per call.
+
+#include "../shell.h"
+#include "bench_util.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+static double per_call_ns(Shell &shell, const string &line, long calls) {
+    double t0 = bench::now_sec();
+    for (long k = 0; k < calls; ++k) shell.run_line(line);
+    return (bench::now_sec() - t0) * 1e9 / calls;
+}
+
+int main(int argc, char **argv) {
+    long calls = argc > 1 ? atol(argv[1]) : 1000000;
+    long script_calls = max(1L, min(calls, 500L));
+    Shell shell;
+    shell.set_args({argv[0]});
+
+    shell.run("f() { :; }\ng() { local v=$1; :; }");
+    const char *helper = "/tmp/myshell_func_bench.sh";
+    int fd = open(helper, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || write(fd, ":\n", 2) != 2) { perror(helper); return 1; }
+    close(fd);
+
+    double fn = per_call_ns(shell, "f", calls);
+    double local_fn = per_call_ns(shell, "g a b", calls);
+    double script = per_call_ns(shell, string("sh ") + helper, script_calls);
+    unlink(helper);
+
+    bench::Result("function_call").num("calls", calls).num("ns_per_call", fn).emit();
+    bench::Result("function_call_local").num("calls", calls).num("ns_per_call", local_fn).emit();
+    bench::Result("script_call")
+        .num("calls", script_calls)
+        .num("ns_per_call", script)
+        .num("function_speedup", script / fn)
+        .emit();
+    return 0;
+}
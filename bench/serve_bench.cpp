@@ -0,0 +1,156 @@
+// Load client for myshell --serve: requests/sec and latency at a given
+// concurrency, against spawning "/bin/sh -c" per request.
+//
+//   make bench
+//   build/myshell --serve /tmp/myshell.sock &
+//   ./build/serve_bench /tmp/myshell.sock [requests] [concurrency] [command]
+//
+// Each of <concurrency> connections keeps one request in flight, with
+// /dev/null passed as the command's stdout (SCM_RIGHTS). The baseline keeps
+// the same number of "/bin/sh -c command" processes running. Defaults: 10000
+// requests, 8 connections, command "true". One JSON line per mode.
+
+#include "bench_util.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+extern char **environ;
+
+static int connect_to(const string &path) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(path.c_str());
+        exit(1);
+    }
+    return fd;
+}
+
+static bool send_request(int conn, const string &command, int out_fd) {
+    string req = "c" + command;
+    req += '\0';
+    char control[CMSG_SPACE(2 * sizeof(int))] = {};
+    struct iovec iov = { &req[0], req.size() };
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(2 * sizeof(int));
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    int fds[2] = { out_fd, out_fd };    // stdin, stdout
+    memcpy(CMSG_DATA(c), fds, sizeof(fds));
+    return sendmsg(conn, &msg, MSG_NOSIGNAL) >= 0;
+}
+
+static void report(const char *name, long requests, int concurrency, double sec, vector<double> &usec) {
+    bench::Result(name)
+        .num("requests", requests)
+        .num("concurrency", concurrency)
+        .num("requests_per_sec", requests / sec)
+        .num("p50_usec", bench::percentile(usec, 50))
+        .num("p99_usec", bench::percentile(usec, 99))
+        .emit();
+}
+
+static void run_server(const string &path, long requests, int concurrency, const string &command) {
+    int devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+    vector<struct pollfd> conns;
+    vector<double> sent_at(concurrency), usec;
+    usec.reserve(requests);
+    long issued = 0, done = 0, errors = 0;
+    double t0 = bench::now_sec();
+    for (int k = 0; k < concurrency && issued < requests; ++k, ++issued) {
+        conns.push_back({connect_to(path), POLLIN, 0});
+        sent_at[k] = bench::now_sec();
+        send_request(conns[k].fd, command, devnull);
+    }
+    char reply[512];
+    while (done < requests) {
+        if (poll(conns.data(), conns.size(), -1) < 0 && errno != EINTR) { perror("poll"); exit(1); }
+        for (size_t k = 0; k < conns.size(); ++k) {
+            if (!conns[k].revents) continue;
+            ssize_t n = recv(conns[k].fd, reply, sizeof(reply) - 1, 0);
+            if (n <= 0) { fprintf(stderr, "serve_bench: server closed the connection\n"); exit(1); }
+            reply[n] = '\0';
+            if (strstr(reply, "error=")) ++errors;
+            usec.push_back((bench::now_sec() - sent_at[k]) * 1e6);
+            ++done;
+            if (issued < requests) {
+                ++issued;
+                sent_at[k] = bench::now_sec();
+                send_request(conns[k].fd, command, devnull);
+            }
+        }
+    }
+    double sec = bench::now_sec() - t0;
+    for (auto &c : conns) close(c.fd);
+    close(devnull);
+    if (errors) fprintf(stderr, "serve_bench: %ld error replies\n", errors);
+    report("serve", requests, concurrency, sec, usec);
+}
+
+static void run_spawn(long requests, int concurrency, const string &command) {
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, 1, "/dev/null", O_WRONLY, 0);
+    const char *argv[] = { "/bin/sh", "-c", command.c_str(), nullptr };
+    unordered_map<pid_t, double> started;
+    vector<double> usec;
+    usec.reserve(requests);
+    long issued = 0, done = 0;
+    double t0 = bench::now_sec();
+    while (done < requests) {
+        while ((long)started.size() < concurrency && issued < requests) {
+            pid_t pid;
+            if (posix_spawn(&pid, argv[0], &fa, nullptr, (char **)argv, environ) != 0) { perror("posix_spawn"); exit(1); }
+            started[pid] = bench::now_sec();
+            ++issued;
+        }
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) { perror("waitpid"); exit(1); }
+        auto it = started.find(pid);
+        if (it == started.end()) continue;
+        usec.push_back((bench::now_sec() - it->second) * 1e6);
+        started.erase(it);
+        ++done;
+    }
+    double sec = bench::now_sec() - t0;
+    posix_spawn_file_actions_destroy(&fa);
+    report("spawn_sh", requests, concurrency, sec, usec);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: serve_bench SOCKET [requests] [concurrency] [command]\n");
+        return 2;
+    }
+    string path = argv[1];
+    long requests = argc > 2 ? atol(argv[2]) : 10000;
+    int concurrency = argc > 3 ? atoi(argv[3]) : 8;
+    string command = argc > 4 ? argv[4] : "true";
+    if (concurrency < 1) concurrency = 1;
+
+    run_server(path, requests, concurrency, command);
+    run_spawn(requests, concurrency, command);
+    return 0;
+}
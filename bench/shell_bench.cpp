@@ -0,0 +1,301 @@
+// Regression suite for the shell's hot paths: parsing, process launch,
+// pipelines, the job table and batch scripts.
+//
+//   make bench
+//   ./build/shell_bench [case...]  # parse launch pipeline jobs script startup (default: all)
+//
+// parse     - Shell::tokenize and Shell::plan ops/sec over a fixed set of lines
+// launch    - "/bin/true" through Shell::run_line: latency p50/p99
+// pipeline  - 1 GiB from /dev/zero through 2, 4 and 8 "cat" stages: GB/s
+// jobs      - lookups, listing and add/remove on a table of 10k jobs
+// script    - a generated N-line script: compile and run lines/sec
+// startup   - for each binary in $MYSHELL (default build/myshell): size, "-c true"
+//             end to end and exec to first prompt, p50/p99. Exits 1 if a
+//             "-c true" median is over $MYSHELL_STARTUP_BUDGET_US (default
+//             1000). "make check" runs this on the default and static builds.
+// Output is one JSON line per measurement, so runs can be diffed over time.
+
+#include "../shell.h"
+#include "bench_util.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+extern char **environ;
+
+static bool over_budget = false;
+
+// sends whatever the shell prints (job listings, echo in scripts) to
+// /dev/null; Shell calls flush their output before returning
+struct SilenceStdout {
+    int saved = dup(STDOUT_FILENO);
+    SilenceStdout() {
+        fflush(stdout);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    ~SilenceStdout() {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+};
+
+static void bench_parse(Shell &shell) {
+    const vector<string> lines = {
+        "ls -la /usr/bin",
+        "grep -n \"main\" *.cpp | sort -k2 | uniq -c > out.txt",
+        "FOO=bar BAZ=\"a b c\" env | grep -v PATH 2>&1",
+        "echo $HOME ${USER} '$not' \"$(pwd)\" done",
+        "make -j8 CFLAGS='-O2 -g' >> build.log 2>&1 &",
+    };
+    const long rounds = 200000;
+    vector<vector<string>> tokens;
+    for (const auto &l : lines) tokens.push_back(shell.tokenize(l));
+
+    volatile size_t sink = 0;   // keeps the results live
+    double t0 = bench::now_sec();
+    for (long r = 0; r < rounds; ++r)
+        for (const auto &l : lines) sink += shell.tokenize(l).size();
+    double parse_sec = bench::now_sec() - t0;
+
+    t0 = bench::now_sec();
+    for (long r = 0; r < rounds; ++r)
+        for (const auto &t : tokens) sink += shell.plan(t).size();
+    double build_sec = bench::now_sec() - t0;
+
+    double ops = (double)rounds * lines.size();
+    bench::Result("tokenize")
+        .num("ops", ops)
+        .num("ops_per_sec", ops / parse_sec)
+        .num("ns_per_op", parse_sec * 1e9 / ops)
+        .emit();
+    bench::Result("plan")
+        .num("ops", ops)
+        .num("ops_per_sec", ops / build_sec)
+        .num("ns_per_op", build_sec * 1e9 / ops)
+        .emit();
+}
+
+static void bench_launch(Shell &shell) {
+    const int launches = 2000;
+    shell.run_line("/bin/true");
+    vector<double> usec;
+    usec.reserve(launches);
+    for (int k = 0; k < launches; ++k) {
+        double t0 = bench::now_sec();
+        shell.run_line("/bin/true");
+        usec.push_back((bench::now_sec() - t0) * 1e6);
+    }
+    bench::Result("launch")
+        .num("launches", launches)
+        .num("p50_usec", bench::percentile(usec, 50))
+        .num("p99_usec", bench::percentile(usec, 99))
+        .emit();
+}
+
+static void bench_pipeline(Shell &shell) {
+    const long bytes = 1L << 30;
+    for (int stages : {2, 4, 8}) {
+        string line = "head -c " + to_string(bytes) + " /dev/zero";
+        for (int s = 1; s < stages; ++s) line += " | cat";
+        line += " > /dev/null";
+        double t0 = bench::now_sec();
+        shell.run_line(line);
+        double sec = bench::now_sec() - t0;
+        bench::Result("pipeline")
+            .num("stages", stages)
+            .num("bytes", bytes)
+            .num("sec", sec)
+            .num("gb_per_sec", bytes / sec / 1e9)
+            .emit();
+    }
+}
+
+static void bench_jobs(Shell &shell) {
+    const int n = 10000;
+    // pids far above pid_max: find_job_by_pid never falls through to a
+    // real process group
+    const pid_t base = 1 << 29;
+    shell.jobs().reserve(n);
+    double t0 = bench::now_sec();
+    for (int k = 0; k < n; ++k)
+        shell.add_job(base + 2 * k, {base + 2 * k, base + 2 * k + 1}, "sleep 100 | cat", RUNNING);
+    double add_sec = bench::now_sec() - t0;
+
+    const int lookups = 20000;
+    size_t found = 0;
+    t0 = bench::now_sec();
+    for (int k = 0; k < lookups; ++k) found += shell.find_job(shell.jobs()[(k * 7919) % n].jid) != nullptr;
+    double jid_sec = bench::now_sec() - t0;
+    t0 = bench::now_sec();
+    for (int k = 0; k < lookups; ++k) found += shell.find_job_by_pid(base + 2 * ((k * 7919) % n) + 1) != nullptr;
+    double pid_sec = bench::now_sec() - t0;
+
+    double list_sec;
+    {
+        SilenceStdout quiet;
+        t0 = bench::now_sec();
+        for (int k = 0; k < 10; ++k) shell.print_jobs();
+        list_sec = (bench::now_sec() - t0) / 10;
+    }
+
+    t0 = bench::now_sec();
+    for (int k = 0; k < n; ++k) shell.remove_job(base + 2 * k);
+    double remove_sec = bench::now_sec() - t0;
+
+    bench::Result("jobs")
+        .num("jobs", n)
+        .num("add_ns", add_sec * 1e9 / n)
+        .num("find_jid_ns", jid_sec * 1e9 / lookups)
+        .num("find_pid_ns", pid_sec * 1e9 / lookups)
+        .num("list_usec", list_sec * 1e6)
+        .num("remove_ns", remove_sec * 1e9 / n)
+        .num("found", found)
+        .emit();
+}
+
+static void bench_script(Shell &shell) {
+    const int lines = 100000;
+    string text;
+    for (int k = 0; k < lines; ++k) {
+        switch (k % 4) {
+        case 0: text += "X=" + to_string(k) + "\n"; break;
+        case 1: text += "echo line $X\n"; break;
+        case 2: text += "true && : || false\n"; break;
+        case 3: text += "if true; then Y=$X; fi\n"; break;
+        }
+    }
+    string error;
+    double t0 = bench::now_sec();
+    shared_ptr<Program> prog = shell.compile(text, error);
+    if (!prog) { fprintf(stderr, "shell_bench: %s\n", error.c_str()); return; }
+    double compile_sec = bench::now_sec() - t0;
+    double run_sec;
+    {
+        SilenceStdout quiet;
+        t0 = bench::now_sec();
+        shell.run(*prog);
+        run_sec = bench::now_sec() - t0;
+    }
+    bench::Result("script")
+        .num("lines", lines)
+        .num("compile_lines_per_sec", lines / compile_sec)
+        .num("run_lines_per_sec", lines / run_sec)
+        .num("total_lines_per_sec", lines / (compile_sec + run_sec))
+        .emit();
+}
+
+// wall time of fork+exec+exit for argv, in microseconds
+static vector<double> spawn_usec(const char *const argv[], int runs) {
+    vector<double> usec;
+    for (int k = 0; k < runs; ++k) {
+        double t0 = bench::now_sec();
+        pid_t pid;
+        int status;
+        if (posix_spawn(&pid, argv[0], nullptr, nullptr, (char **)argv, environ) != 0) break;
+        waitpid(pid, &status, 0);
+        usec.push_back((bench::now_sec() - t0) * 1e6);
+    }
+    return usec;
+}
+
+// exec until the first prompt arrives on stdout (stdin is a pipe, closed
+// afterwards so the shell exits)
+static vector<double> first_prompt_usec(const char *binary, int runs) {
+    vector<double> usec;
+    const char *argv[] = { binary, nullptr };
+    for (int k = 0; k < runs; ++k) {
+        int in[2], out[2];
+        if (pipe2(in, O_CLOEXEC) < 0 || pipe2(out, O_CLOEXEC) < 0) break;
+        posix_spawn_file_actions_t fa;
+        posix_spawn_file_actions_init(&fa);
+        posix_spawn_file_actions_adddup2(&fa, in[0], STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&fa, out[1], STDOUT_FILENO);
+        double t0 = bench::now_sec();
+        pid_t pid;
+        int rc = posix_spawn(&pid, binary, &fa, nullptr, (char **)argv, environ);
+        posix_spawn_file_actions_destroy(&fa);
+        close(in[0]);
+        close(out[1]);
+        if (rc == 0) {
+            char buf[64];
+            ssize_t n = read(out[0], buf, sizeof(buf));
+            if (n > 0) usec.push_back((bench::now_sec() - t0) * 1e6);
+        }
+        close(in[1]);
+        close(out[0]);
+        if (rc != 0) break;
+        int status;
+        waitpid(pid, &status, 0);
+    }
+    return usec;
+}
+
+static void bench_startup(Shell &) {
+    const int runs = 500;
+    string binaries = getenv("MYSHELL") ? getenv("MYSHELL") : "build/myshell";
+    double budget = getenv("MYSHELL_STARTUP_BUDGET_US") ? atof(getenv("MYSHELL_STARTUP_BUDGET_US")) : 1000;
+
+    const char *sh_argv[] = { "/bin/sh", "-c", "true", nullptr };
+    double sh_p50 = bench::percentile(spawn_usec(sh_argv, runs), 50);
+
+    size_t from = 0;
+    while (from < binaries.size()) {
+        size_t to = binaries.find(' ', from);
+        if (to == string::npos) to = binaries.size();
+        string binary = binaries.substr(from, to - from);
+        from = to + 1;
+        if (binary.empty()) continue;
+
+        struct stat st;
+        const char *argv[] = { binary.c_str(), "-c", "true", nullptr };
+        vector<double> usec = spawn_usec(argv, runs);
+        vector<double> prompt = first_prompt_usec(binary.c_str(), runs);
+        if (stat(binary.c_str(), &st) < 0 || usec.empty() || prompt.empty()) {
+            perror(binary.c_str());
+            over_budget = true;
+            continue;
+        }
+        double p50 = bench::percentile(usec, 50);
+        if (p50 > budget) over_budget = true;
+        bench::Result("startup")
+            .str("binary", binary)
+            .num("size_bytes", st.st_size)
+            .num("runs", runs)
+            .num("c_true_p50_usec", p50)
+            .num("c_true_p99_usec", bench::percentile(usec, 99))
+            .num("first_prompt_p50_usec", bench::percentile(prompt, 50))
+            .num("first_prompt_p99_usec", bench::percentile(prompt, 99))
+            .num("sh_c_true_p50_usec", sh_p50)
+            .num("budget_usec", budget)
+            .num("within_budget", p50 <= budget)
+            .emit();
+    }
+}
+
+int main(int argc, char **argv) {
+    Shell shell;
+
+    struct Case { const char *name; void (*fn)(Shell &); };
+    const Case cases[] = {
+        { "parse", bench_parse },
+        { "launch", bench_launch },
+        { "pipeline", bench_pipeline },
+        { "jobs", bench_jobs },
+        { "script", bench_script },
+        { "startup", bench_startup },
+    };
+    for (const auto &c : cases) {
+        bool wanted = argc < 2;
+        for (int i = 1; i < argc; ++i) wanted |= strcmp(argv[i], c.name) == 0;
+        if (wanted) c.fn(shell);
+    }
+    return over_budget ? 1 : 0;
+}
@@ -0,0 +1,57 @@
+// Script execution: bytecode VM vs running each line through the front end.
+//
+//   make bench     (or: g++ -O2 -std=c++17 bench/vm_bench.cpp -o vm_bench)
+//   ./vm_bench [iterations]
+//
+// The loop body is the ":" builtin, iterated 1M times (default):
+//   vm        - ITER / BUILTIN / JUMP over the compiled program
+//   cached    - execute_line(":") per iteration (command cache hit)
+//   reparse   - parseInput + buildCommands + PATH resolution per iteration
+
+// uses the compiler and VM internals, so it builds shell.cpp in
+#include "../shell.cpp"
+#include "bench_util.h"
+
+int main(int argc, char **argv) {
+    long iters = argc > 1 ? atol(argv[1]) : 1000000;
+    Shell shell;
+
+    // for i in <iters words>; do :; done
+    Program prog;
+    Compiler comp(prog);
+    uint32_t loop = comp.add_list(vector<string>(iters, "x"));
+    comp.emit(OP_ITER_INIT, loop);
+    uint32_t top = comp.emit(OP_ITER, loop, comp.add_string("i"));
+    comp.line(":");
+    comp.emit(OP_JUMP, top);
+    comp.patch(top, comp.here());
+    comp.emit(OP_HALT);
+
+    double t0 = bench::now_sec();
+    run_program(prog);
+    double t1 = bench::now_sec();
+    for (long k = 0; k < iters; ++k) {
+        shell.set_var("i", "x");
+        execute_line(":");
+    }
+    double t2 = bench::now_sec();
+    for (long k = 0; k < iters; ++k) {
+        shell.set_var("i", "x");
+        CompiledLine c;
+        LexInfo info;
+        c.tokens = parseInput(":", &info);
+        c.cmds = buildCommands(c.tokens, &info);
+        resolveCommands(c.cmds);
+        run_compiled(c, false, ":");
+    }
+    double t3 = bench::now_sec();
+
+    bench::Result("script_loop_builtin")
+        .num("iterations", iters)
+        .num("vm_ns_per_iter", (t1 - t0) * 1e9 / iters)
+        .num("cached_ns_per_iter", (t2 - t1) * 1e9 / iters)
+        .num("reparse_ns_per_iter", (t3 - t2) * 1e9 / iters)
+        .num("speedup_vs_reparse", (t3 - t2) / (t1 - t0))
+        .emit();
+    return 0;
+}
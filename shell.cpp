@@ -0,0 +1,5358 @@
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <cstdlib>
+#include <cerrno>
+#include <signal.h>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <fcntl.h>
+#include <termios.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <list>
+#include <cstdint>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <string_view>
+#include <charconv>
+#include <unordered_map>
+#include <memory>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <ctime>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "shell.h"
+
+using namespace std;
+
+// trim helpers
+static inline void rtrim(string &s) {
+    while (!s.empty() && isspace((unsigned char)s.back())) s.pop_back();
+}
+static inline void ltrim(string &s) {
+    size_t i = 0;
+    while (i < s.size() && isspace((unsigned char)s[i])) ++i;
+    if (i) s.erase(0, i);
+}
+static inline void trim(string &s) { ltrim(s); rtrim(s); }
+
+// ---- output ----
+// The shell's own stdout and stderr: a small buffer over write(2) rather
+// than iostreams, so there is no stream or locale setup at startup and a
+// static build stays small. stdout is flushed explicitly (before a fork, at
+// the prompt, when a library call returns); stderr flushes stdout first and
+// itself at every newline, like cerr. While a builtin runs for $(...),
+// stdout can be pointed at a CaptureBuffer instead of the fd.
+
+class CaptureBuffer;
+
+class FdWriter {
+public:
+    explicit FdWriter(int fd, FdWriter *tie = nullptr) : fd_(fd), tie_(tie) {}
+    FdWriter(const FdWriter &) = delete;
+    FdWriter &operator=(const FdWriter &) = delete;
+    ~FdWriter() { flush(); }
+
+    FdWriter &operator<<(string_view s) { write(s.data(), s.size()); return *this; }
+    FdWriter &operator<<(const char *s) { return *this << string_view(s); }
+    FdWriter &operator<<(const string &s) { return *this << string_view(s); }
+    FdWriter &operator<<(char c) { write(&c, 1); return *this; }
+    template <class T, class = enable_if_t<is_integral<T>::value>>
+    FdWriter &operator<<(T v) {
+        char num[24];
+        auto r = to_chars(num, num + sizeof(num), v);
+        write(num, r.ptr - num);
+        return *this;
+    }
+    FdWriter &put(char c) { return *this << c; }
+
+    void write(const char *p, size_t n);      // defined after CaptureBuffer
+
+    void flush() {
+        write_all(buf_, len_);
+        len_ = 0;
+    }
+
+    // send output to buf (nullptr: back to the fd)
+    void capture(CaptureBuffer *buf) {
+        flush();
+        capture_ = buf;
+    }
+
+private:
+    void write_all(const char *p, size_t n) {
+        while (n) {
+            ssize_t w = ::write(fd_, p, n);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) break;      // like a failed stream: drop the output
+            p += w;
+            n -= w;
+        }
+    }
+
+    int fd_;
+    FdWriter *tie_;
+    CaptureBuffer *capture_ = nullptr;
+    char buf_[4096];
+    size_t len_ = 0;
+};
+
+static FdWriter std_out(STDOUT_FILENO);
+static FdWriter std_err(STDERR_FILENO, &std_out);
+
+static sigset_t sigchld_mask;
+
+extern char **environ;
+
+// ---- shell variables ----
+// All variables live in one table; exported ones are mirrored into a
+// contiguous envp array that is rebuilt lazily, only after an exported
+// variable changed, so forking a command never pays for it.
+
+struct Var {
+    string value;
+    bool exported = false;
+};
+
+class Environment {
+public:
+    void import(char **envp) {
+        for (char **e = envp; e && *e; ++e) {
+            const char *eq = strchr(*e, '=');
+            if (!eq) continue;
+            Var &v = vars_[string(*e, eq - *e)];
+            v.value = eq + 1;
+            v.exported = true;
+        }
+        dirty_ = true;
+    }
+
+    const string* get(const string &name) const {
+        auto it = vars_.find(name);
+        return it == vars_.end() ? nullptr : &it->second.value;
+    }
+
+    string value(const string &name) const {
+        const string *v = get(name);
+        return v ? *v : string();
+    }
+
+    void set(const string &name, const string &value, bool do_export = false) {
+        auto it = vars_.find(name);
+        if (it != vars_.end() && it->second.value == value && (it->second.exported || !do_export))
+            return;             // unchanged - keep envp as is
+        Var &v = vars_[name];
+        v.value = value;
+        if (do_export) v.exported = true;
+        if (v.exported) dirty_ = true;
+    }
+
+    void export_var(const string &name) {
+        Var &v = vars_[name];
+        if (!v.exported) { v.exported = true; dirty_ = true; }
+    }
+
+    // the variable itself, nullptr if unset
+    const Var* find(const string &name) const {
+        auto it = vars_.find(name);
+        return it == vars_.end() ? nullptr : &it->second;
+    }
+
+    // put back a variable saved from find(), or remove it if it was unset
+    void restore(const string &name, const Var *saved) {
+        if (!saved) { unset(name); return; }
+        Var &v = vars_[name];
+        if (v.exported || saved->exported) dirty_ = true;
+        v = *saved;
+    }
+
+    void unset(const string &name) {
+        auto it = vars_.find(name);
+        if (it == vars_.end()) return;
+        if (it->second.exported) dirty_ = true;
+        vars_.erase(it);
+    }
+
+    // envp for execve; stays valid until the next exported change
+    char **envp() {
+        if (dirty_) {
+            env_strings_.clear();
+            for (const auto &kv : vars_)
+                if (kv.second.exported) env_strings_.push_back(kv.first + "=" + kv.second.value);
+            sort(env_strings_.begin(), env_strings_.end());
+            envp_.clear();
+            for (auto &e : env_strings_) envp_.push_back(&e[0]);
+            envp_.push_back(nullptr);
+            dirty_ = false;
+        }
+        return envp_.data();
+    }
+
+    void print_exported() const {
+        vector<string> names;
+        for (const auto &kv : vars_) if (kv.second.exported) names.push_back(kv.first);
+        sort(names.begin(), names.end());
+        for (const auto &n : names) std_out << "export " << n << "=\"" << vars_.at(n).value << "\"\n";
+    }
+
+private:
+    unordered_map<string, Var> vars_;
+    vector<string> env_strings_;
+    vector<char*> envp_;
+    bool dirty_ = true;
+};
+
+string param_value(const string &name);
+
+// ---- compiled command cache ----
+// Maps an exact input line to its tokens and resolved commands so repeated
+// lines skip lexing, parsing and PATH lookup. Each entry remembers the values
+// of the variables it was compiled against and is dropped when they change.
+
+struct CompiledLine {
+    vector<string> tokens;
+    vector<Command> cmds;
+    bool background = false;                  // line ended with a separate "&" token
+    bool failed = false;                      // an expansion error was reported
+    vector<pair<string, string>> deps;        // variable -> value seen at compile time
+};
+
+class CommandCache {
+public:
+    explicit CommandCache(size_t capacity) : capacity_(capacity) {}
+
+    // returns nullptr on miss or when a dependency changed
+    CompiledLine* lookup(const string &line) {
+        auto it = index_.find(line);
+        if (it == index_.end()) { ++misses_; return nullptr; }
+        if (!deps_current(it->second->second)) {
+            lru_.erase(it->second);
+            index_.erase(it);
+            ++invalidations_;
+            ++misses_;
+            return nullptr;
+        }
+        lru_.splice(lru_.begin(), lru_, it->second);
+        ++hits_;
+        return &it->second->second;
+    }
+
+    CompiledLine* insert(const string &line, CompiledLine entry) {
+        auto it = index_.find(line);
+        if (it != index_.end()) {
+            lru_.erase(it->second);
+            index_.erase(it);
+        }
+        lru_.emplace_front(line, std::move(entry));
+        index_[line] = lru_.begin();
+        if (lru_.size() > capacity_) {
+            index_.erase(lru_.back().first);
+            lru_.pop_back();
+        }
+        return &lru_.front().second;
+    }
+
+    void clear() {
+        lru_.clear();
+        index_.clear();
+    }
+
+    void print_stats() const {
+        unsigned long total = hits_ + misses_;
+        std_out << "entries " << lru_.size() << "/" << capacity_
+             << "  hits " << hits_ << "  misses " << misses_
+             << "  invalidated " << invalidations_
+             << "  hit-rate " << (total ? (100 * hits_ / total) : 0) << "%\n";
+        for (const auto &e : lru_) std_out << "  " << e.first << "\n";
+    }
+
+private:
+    static bool deps_current(const CompiledLine &c) {
+        for (const auto &d : c.deps)
+            if (param_value(d.first) != d.second) return false;
+        return true;
+    }
+
+    typedef list<pair<string, CompiledLine>> LruList;
+    size_t capacity_;
+    LruList lru_;
+    unordered_map<string, LruList::iterator> index_;
+    unsigned long hits_ = 0, misses_ = 0, invalidations_ = 0;
+};
+
+// ---- job deadlines ----
+// "timeout DURATION cmd" gives a job a deadline. Deadlines sit in a binary
+// min-heap ordered by expiry and a single timerfd is armed for the earliest,
+// so the prompt loop, wait and fg only wake up when one is due. A job that
+// finishes first is just dropped from the index; its stale heap entries are
+// skipped when they reach the top. Adding, expiring and cancelling all stay
+// O(log n) with thousands of timed jobs.
+
+// keep a shell-internal fd out of the 0-9 range that redirections like 3>file use
+static int high_fd(int fd) {
+    if (fd < 0 || fd >= 10) return fd;
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    if (high < 0) return fd;
+    close(fd);
+    return high;
+}
+
+struct Deadline {
+    int64_t when;       // CLOCK_MONOTONIC, ms
+    uint64_t id;        // stale unless it matches the job's current timer
+    pid_t pgid;
+    bool operator>(const Deadline &o) const { return when > o.when; }
+};
+
+class DeadlineQueue {
+public:
+    DeadlineQueue() = default;
+    DeadlineQueue(const DeadlineQueue &) = delete;
+    DeadlineQueue &operator=(const DeadlineQueue &) = delete;
+    ~DeadlineQueue() { if (fd_ >= 0) close(fd_); }
+
+    int fd() const { return fd_; }
+    bool pending() const { return !timers_.empty(); }
+
+    // SIGTERM to pgid at when, SIGKILL grace_ms after that; replaces any
+    // deadline pgid already had
+    void add(pid_t pgid, int64_t when, int64_t grace_ms) {
+        if (fd_ < 0) {
+            fd_ = high_fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+            if (fd_ < 0) { perror("timerfd_create"); return; }
+        }
+        Timer &t = timers_[pgid];
+        t = Timer{++next_id_, grace_ms, 0};
+        push(Deadline{when, t.id, pgid});
+        rearm();
+    }
+
+    // Pop the next deadline due at now: sig is what to send (SIGTERM, or
+    // SIGKILL once the grace period is over too). False when none is due;
+    // the timer is then armed for the next one.
+    bool due(int64_t now, pid_t &pgid, int &sig) {
+        drop_stale();
+        if (heap_.empty() || heap_.front().when > now) {
+            rearm();
+            return false;
+        }
+        Deadline d = heap_.front();
+        pop_heap(heap_.begin(), heap_.end(), greater<Deadline>());
+        heap_.pop_back();
+        Timer &t = timers_[d.pgid];
+        sig = t.sent ? SIGKILL : SIGTERM;
+        if (!t.sent) push(Deadline{now + t.grace_ms, t.id, d.pgid});
+        t.sent = sig;
+        pgid = d.pgid;
+        return true;
+    }
+
+    // consume the timerfd's expiration count
+    void acknowledge() {
+        uint64_t ticks;
+        if (fd_ >= 0 && read(fd_, &ticks, sizeof(ticks)) < 0) {}
+    }
+
+    // the job is gone: forget its deadline; returns the last signal it sent (0: none)
+    int finish(pid_t pgid) {
+        auto it = timers_.find(pgid);
+        if (it == timers_.end()) return 0;
+        int sent = it->second.sent;
+        timers_.erase(it);
+        if (timers_.empty()) {
+            heap_.clear();
+            rearm();
+        }
+        return sent;
+    }
+
+    // in a forked child: the deadlines belong to the parent
+    void clear() {
+        timers_.clear();
+        heap_.clear();
+        if (fd_ >= 0) close(fd_);
+        fd_ = -1;
+        armed_ = 0;
+    }
+
+private:
+    struct Timer {
+        uint64_t id;
+        int64_t grace_ms;
+        int sent;           // last signal sent
+    };
+
+    void push(const Deadline &d) {
+        heap_.push_back(d);
+        push_heap(heap_.begin(), heap_.end(), greater<Deadline>());
+    }
+
+    void drop_stale() {
+        while (!heap_.empty()) {
+            auto it = timers_.find(heap_.front().pgid);
+            if (it != timers_.end() && it->second.id == heap_.front().id) return;
+            pop_heap(heap_.begin(), heap_.end(), greater<Deadline>());
+            heap_.pop_back();
+        }
+    }
+
+    // point the timerfd at the earliest deadline; no syscall if it already is
+    void rearm() {
+        drop_stale();
+        int64_t when = heap_.empty() ? 0 : max<int64_t>(heap_.front().when, 1);
+        if (fd_ < 0 || when == armed_) return;
+        struct itimerspec its = {};
+        its.it_value.tv_sec = when / 1000;
+        its.it_value.tv_nsec = (when % 1000) * 1000000;
+        timerfd_settime(fd_, TFD_TIMER_ABSTIME, &its, nullptr);     // zero disarms
+        armed_ = when;
+    }
+
+    vector<Deadline> heap_;
+    unordered_map<pid_t, Timer> timers_;    // by pgid
+    uint64_t next_id_ = 0;
+    int64_t armed_ = 0;
+    int fd_ = -1;
+};
+
+// ---- shell context ----
+// Everything a running shell owns lives in one ShellState, reached through
+// sh. A Shell (shell.h) makes its state current on every call, so several
+// shells can live in one process as long as only one runs at a time.
+
+struct Ast;
+
+struct Function {
+    shared_ptr<Ast> ast;
+    uint32_t body;
+};
+
+struct SavedVar {
+    string name;
+    bool was_set;
+    Var var;
+};
+
+// captured output of a background job (set -o joblog)
+struct JobLog {
+    int jid;                // 0 until finish_job registers the job
+    string cmd;
+    int pipe_fd;            // read end, -1 once every writer is gone
+    int ring_fd;            // memfd holding the last `capacity` bytes
+    uint64_t capacity;
+    uint64_t written = 0;   // bytes received in total
+};
+
+// a running coproc: its stdout and stdin, as seen from the shell
+struct Coproc {
+    string name;
+    pid_t pgid;
+    int read_fd, write_fd;
+};
+
+struct ShellState {
+    vector<Job> jobs;
+    int next_jid = 1;
+    vector<Job> done_jobs;          // finished but not waited for, oldest first
+    pid_t shell_pgid = 0;
+    pid_t shell_pid = 0;            // $$: the shell's pid, also in its subshells
+    struct termios shell_tmodes {};
+    bool interactive = false;   // stdin is a terminal
+    bool job_control = false;   // false in subshells: never touch the terminal's pgrp
+    int sigchld_fd = -1;        // signalfd for SIGCHLD, polled together with stdin
+    bool watching_children = false;     // sigchld_fd set up (first prompt)
+
+    Environment env;
+    // $0 followed by $1..$n: the script's arguments, or a function's while it runs
+    vector<string> positional_params;
+    CommandCache cmd_cache{128};
+
+    // shell options (set -o)
+    bool opt_fadvise = false;   // sequential-access advice on redirected files
+    bool opt_odirect = false;   // open > / >> targets of external commands with O_DIRECT
+    bool opt_joblog = false;    // capture background jobs' output
+    bool opt_pipefail = false;  // a pipeline's status is that of its last failing stage
+
+    // evaluator
+    int loop_depth = 0;         // loops currently running (for break/continue)
+    int break_levels = 0;       // pending "break n"
+    int continue_levels = 0;    // pending "continue n"
+    int function_depth = 0;     // function calls currently running (for return)
+    bool returning = false;     // "return" is unwinding the innermost call
+    int last_exit_status = 0;   // $?
+    vector<int> pipe_status{0}; // PIPESTATUS: per stage of the last foreground pipeline
+
+    // shell functions and the frames of "local"
+    unordered_map<string, Function> functions;
+    vector<SavedVar> local_stack;
+    vector<size_t> local_frames;    // local_stack height at each active call
+
+    vector<JobLog> job_logs;        // oldest first
+    DeadlineQueue deadlines;        // timeout DURATION cmd
+    vector<Coproc> coprocs;
+};
+
+static ShellState *sh = nullptr;
+
+// The coprocess pipes are close-on-exec, but a fork that runs shell code
+// instead of exec'ing would keep them open, and the coprocess would not see
+// EOF when the shell closes its end.
+static void close_coproc_fds() {
+    for (const auto &c : sh->coprocs) {
+        close(c.read_fd);
+        close(c.write_fd);
+    }
+    sh->coprocs.clear();
+}
+
+// in a fork that goes on running shell code: the parent's jobs, deadlines
+// and coprocesses are not this process's
+static void leave_parent_shell() {
+    sh->jobs.clear();
+    sh->deadlines.clear();
+    sh->job_control = false;
+    sh->interactive = false;
+    close_coproc_fds();
+}
+
+// value of a parameter by name, including $1.., $# and $@
+string param_value(const string &name) {
+    if (name.empty()) return string();
+    if (isdigit((unsigned char)name[0])) {
+        size_t k = strtoul(name.c_str(), nullptr, 10);
+        return k < sh->positional_params.size() ? sh->positional_params[k] : string();
+    }
+    if (name == "#") return to_string(sh->positional_params.empty() ? 0 : sh->positional_params.size() - 1);
+    if (name == "?") return to_string(sh->last_exit_status);
+    if (name == "PIPESTATUS") {
+        // formatted only when asked for: collecting it is a store per stage
+        string all;
+        for (size_t k = 0; k < sh->pipe_status.size(); ++k) {
+            if (k) all += ' ';
+            all += to_string(sh->pipe_status[k]);
+        }
+        return all;
+    }
+    if (name == "@" || name == "*") {
+        string all;
+        for (size_t k = 1; k < sh->positional_params.size(); ++k) {
+            if (k > 1) all += ' ';
+            all += sh->positional_params[k];
+        }
+        return all;
+    }
+    return sh->env.value(name);
+}
+
+// status of a command that ran without a pipeline: all of PIPESTATUS
+static inline int single_status(int status) {
+    sh->pipe_status.assign(1, status);
+    return status;
+}
+
+static inline bool is_name_start(char c) { return isalpha((unsigned char)c) || c == '_'; }
+static inline bool is_name_char(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+// "NAME=..." -> length of NAME, otherwise 0
+size_t assignment_name_len(const string &word) {
+    if (word.empty() || !is_name_start(word[0])) return 0;
+    size_t i = 1;
+    while (i < word.size() && is_name_char(word[i])) ++i;
+    return (i < word.size() && word[i] == '=') ? i : 0;
+}
+
+// what a token is, decided by the lexer: quoted or expanded text is never syntax
+enum TokKind : uint8_t {
+    TK_WORD,
+    TK_OP,          // | & or a redirection operator, as written unquoted
+    TK_ASSIGN,      // a word starting with an unquoted NAME=
+};
+
+struct LexInfo {
+    vector<string> used_vars;       // variables referenced by the line
+    vector<TokKind> kinds;          // per token
+    vector<string> patterns;        // per token: glob pattern, or "" if not a glob
+    bool has_substitution = false;  // output depends on running commands: do not cache
+    bool assigns = false;           // ${NAME:=word} set a variable: do not cache
+    bool failed = false;            // an expansion error was reported: do not run the line
+    vector<pair<size_t, ProcSubst>> substs;    // token index -> <(cmd) / >(cmd) in it
+};
+
+vector<string> parseInput(const string &input, LexInfo *info = nullptr);
+
+// index of the '}' closing a ${ whose body starts at i, or npos
+static size_t find_brace_end(const string &s, size_t i) {
+    int depth = 1;
+    for (; i < s.size(); ++i) {
+        if (s[i] == '\\') ++i;
+        else if (s[i] == '{') ++depth;
+        else if (s[i] == '}' && --depth == 0) return i;
+    }
+    return string::npos;
+}
+
+static bool is_param_name(const string &name) {
+    if (name.size() == 1 && (isdigit((unsigned char)name[0]) || strchr("#@*?$", name[0]))) return true;
+    if (name.empty() || !is_name_start(name[0])) return false;
+    return all_of(name.begin(), name.end(), is_name_char);
+}
+
+// ${NAME op word} with op one of - = + ? (:- := :+ :? also treat an empty
+// value as unset). The word is expanded only when it is used; returns false
+// after reporting an error.
+static bool expand_operator(const string &name, const string &op, const string &arg,
+                            string &word, LexInfo *info) {
+    string value = param_value(name);
+    bool set;
+    if (is_name_start(name[0])) set = sh->env.get(name) != nullptr;
+    else if (isdigit((unsigned char)name[0])) set = stoul(name) < sh->positional_params.size();
+    else if (name == "@" || name == "*") set = sh->positional_params.size() > 1;
+    else set = true;
+    if (op[0] == ':' && value.empty()) set = false;
+    char kind = op.back();
+    if (set != (kind == '+')) {
+        if (kind != '+') word += value;
+        return true;
+    }
+    // the word replaces the value: expand it like the rest of the line
+    LexInfo nested;
+    vector<string> words = parseInput(arg, &nested);
+    string text;
+    for (size_t w = 0; w < words.size(); ++w) {
+        if (w) text += ' ';
+        text += words[w];
+    }
+    if (info) {
+        info->used_vars.insert(info->used_vars.end(), nested.used_vars.begin(), nested.used_vars.end());
+        info->has_substitution |= nested.has_substitution;
+        info->assigns |= nested.assigns;
+    }
+    if (nested.failed) {
+        if (info) info->failed = true;
+        return false;
+    }
+    if (kind == '?') {
+        std_err << "myshell: " << name << ": " << (text.empty() ? "parameter null or not set" : text) << "\n";
+        if (info) info->failed = true;
+        return false;
+    }
+    if (kind == '=') {
+        if (!is_name_start(name[0])) {
+            std_err << "myshell: $" << name << ": cannot assign in this way\n";
+            if (info) info->failed = true;
+            return false;
+        }
+        sh->env.set(name, text);
+        if (info) info->assigns = true;
+    }
+    word += text;
+    return true;
+}
+
+// Expand the parameter starting at input[i] (just after '$') into word.
+// Advances i past the reference; records referenced names in info.
+static void expand_param(const string &input, size_t &i, string &word, LexInfo *info) {
+    vector<string> *used_vars = info ? &info->used_vars : nullptr;
+    string name;
+    if (i < input.size() && input[i] == '{') {
+        size_t close = find_brace_end(input, i + 1);
+        if (close == string::npos) { word += "${"; ++i; return; }
+        name = input.substr(i + 1, close - i - 1);
+        i = close + 1;
+        size_t open = name.find('[');
+        if (open != string::npos && name.back() == ']') {
+            // ${NAME[k]}: the k-th word of NAME (there are no arrays: a
+            // list such as PIPESTATUS is a space-separated value)
+            string index = name.substr(open + 1, name.size() - open - 2);
+            name.erase(open);
+            if (used_vars) used_vars->push_back(name);
+            string value = param_value(name);
+            if (index == "@" || index == "*") {
+                word += value;
+                return;
+            }
+            size_t k = strtoul(index.c_str(), nullptr, 10), pos = 0;
+            while (true) {
+                pos = value.find_first_not_of(' ', pos);
+                if (pos == string::npos) return;
+                size_t end = min(value.find(' ', pos), value.size());
+                if (k-- == 0) {
+                    word.append(value, pos, end - pos);
+                    return;
+                }
+                pos = end;
+            }
+        }
+        size_t len = 0;
+        if (!name.empty() && is_name_start(name[0])) {
+            while (len < name.size() && is_name_char(name[len])) ++len;
+        } else if (!name.empty()) {
+            len = 1;
+        }
+        size_t op_len = len < name.size() ? (name[len] == ':' ? 2 : 1) : 0;
+        string base = name.substr(0, len);
+        if (op_len && len + op_len <= name.size() && strchr("-=+?", name[len + op_len - 1]) &&
+            is_param_name(base)) {
+            if (used_vars) used_vars->push_back(base);
+            expand_operator(base, name.substr(len, op_len), name.substr(len + op_len), word, info);
+            return;
+        }
+        if (!is_param_name(name)) {
+            std_err << "myshell: ${" << name << "}: bad substitution\n";
+            if (info) info->failed = true;
+            return;
+        }
+        if (name == "$") {
+            word += to_string(sh->shell_pid);
+            return;
+        }
+    } else if (i < input.size() && input[i] == '$') {
+        word += to_string(sh->shell_pid);
+        ++i;
+        return;
+    } else if (i < input.size() && is_name_start(input[i])) {
+        size_t start = i;
+        while (i < input.size() && is_name_char(input[i])) ++i;
+        name = input.substr(start, i - start);
+    } else if (i < input.size() && (isdigit((unsigned char)input[i]) || strchr("#@*?", input[i]))) {
+        name = input.substr(i++, 1);
+    } else {
+        word += '$';            // lone '$' is literal
+        return;
+    }
+    if (used_vars) used_vars->push_back(name);
+    word += param_value(name);
+}
+
+int execute_line(string input);
+int eval_source(const string &src);
+bool is_shell_function(const string &name);
+int call_function(const vector<string> &argv, const vector<string> &assigns);
+void remove_function(const string &name);
+int run_compiled(CompiledLine &compiled, bool background, const string &input);
+uint64_t parse_size(const string &text);
+int parse_job_token(const string &arg);
+bool run_output_builtin(const vector<string> &argv, int &status);
+vector<Command> buildCommands(const vector<string>& tokens, const LexInfo *info);
+void expandGlobs(vector<Command> &cmds);
+string resolve_path(const string &name);
+Job *find_job_arg(const string &arg);
+
+// ---- command substitution ----
+// Output of $(cmd) / `cmd` is read straight into an anonymous mapping that
+// grows with mremap (no intermediate std::string), then split in place into
+// string_view fields; each field is copied once, into its final word.
+
+class CaptureBuffer {
+public:
+    CaptureBuffer() = default;
+    CaptureBuffer(const CaptureBuffer&) = delete;
+    CaptureBuffer& operator=(const CaptureBuffer&) = delete;
+    ~CaptureBuffer() { if (data_) munmap(data_, cap_); }
+
+    void append(const char *p, size_t n) {
+        reserve(n);
+        memcpy(data_ + size_, p, n);
+        size_ += n;
+    }
+
+    // read fd until EOF
+    void read_from(int fd) {
+        while (true) {
+            reserve(16 * 1024);
+            ssize_t n = read(fd, data_ + size_, cap_ - size_);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            size_ += n;
+        }
+    }
+
+    string_view view() const { return string_view(data_ ? data_ : "", size_); }
+
+private:
+    // make room for at least n more bytes
+    void reserve(size_t n) {
+        if (size_ + n <= cap_) return;
+        size_t want = max(cap_ ? cap_ * 2 : (size_t)64 * 1024, size_ + n);
+        void *p = data_ ? mremap(data_, cap_, want, MREMAP_MAYMOVE)
+                        : mmap(nullptr, want, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) throw bad_alloc();
+        data_ = static_cast<char*>(p);
+        cap_ = want;
+    }
+
+    char *data_ = nullptr;
+    size_t size_ = 0, cap_ = 0;
+};
+
+void FdWriter::write(const char *p, size_t n) {
+    if (capture_) {
+        capture_->append(p, n);
+        return;
+    }
+    if (tie_) tie_->flush();
+    if (len_ + n > sizeof(buf_)) {
+        flush();
+        if (n > sizeof(buf_)) {
+            write_all(p, n);
+            return;
+        }
+    }
+    memcpy(buf_ + len_, p, n);
+    len_ += n;
+    if (tie_ && memchr(p, '\n', n)) flush();
+}
+
+// Run text with its stdout captured. A lone echo/pwd/jobs runs in-process;
+// anything else runs in a forked copy of the shell.
+int capture_output(const string &text, CaptureBuffer &buf) {
+    if (text.find_first_of("|<>&;`") == string::npos && text.find("$(") == string::npos) {
+        LexInfo info;
+        vector<string> tokens = parseInput(text, &info);
+        vector<Command> cmds = buildCommands(tokens, &info);
+        if (cmds.size() == 1 && cmds[0].assigns.empty() && !cmds[0].argv.empty()) {
+            expandGlobs(cmds);      // $(echo *.c)
+            int status = 0;
+            std_out.capture(&buf);
+            bool handled = run_output_builtin(cmds[0].argv, status);
+            std_out.capture(nullptr);
+            if (handled) return status;
+        }
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) { perror("pipe"); return 1; }
+    std_out.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        leave_parent_shell();
+        int status = eval_source(text);
+        std_out.flush();
+        _exit(status);
+    }
+    close(fds[1]);
+    buf.read_from(fds[0]);
+    close(fds[0]);
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// split on IFS whitespace into slices of data
+void split_fields(string_view data, vector<string_view> &fields) {
+    const string *ifs_var = sh->env.get("IFS");
+    const char *ifs = ifs_var ? ifs_var->c_str() : " \t\n";
+    size_t i = 0;
+    while (i < data.size()) {
+        while (i < data.size() && strchr(ifs, data[i])) ++i;
+        size_t start = i;
+        while (i < data.size() && !strchr(ifs, data[i])) ++i;
+        if (i > start) fields.push_back(data.substr(start, i - start));
+    }
+}
+
+// index of the ')' closing a $( opened just before i, or npos
+static size_t find_subst_end(const string &s, size_t i) {
+    int depth = 1;
+    while (i < s.size()) {
+        char c = s[i];
+        if (c == '\\') {
+            i += 2;
+            continue;
+        } else if (c == '\'') {
+            i = s.find('\'', i + 1);
+            if (i == string::npos) return i;
+        } else if (c == '"') {
+            for (++i; i < s.size() && s[i] != '"'; ++i)
+                if (s[i] == '\\') ++i;
+        } else if (c == '(') {
+            ++depth;
+        } else if (c == ')' && --depth == 0) {
+            return i;
+        }
+        ++i;
+    }
+    return string::npos;
+}
+
+// the command text of a substitution starting at input[i] ("$(" or "`");
+// advances i past it
+static string substitution_text(const string &input, size_t &i) {
+    if (input[i] == '$') {
+        size_t end = find_subst_end(input, i + 2);
+        if (end == string::npos) end = input.size();
+        string text = input.substr(i + 2, end - i - 2);
+        i = end + 1;
+        return text;
+    }
+    string text;
+    for (++i; i < input.size() && input[i] != '`'; ++i) {
+        if (input[i] == '\\' && i + 1 < input.size() && strchr("`\\$", input[i + 1])) ++i;
+        text += input[i];
+    }
+    ++i;                        // closing backtick
+    return text;
+}
+
+// Length of the redirection operator at s[i], 0 if there is none:
+// < > >> <> <& >& << <<- <<< &> &>>
+size_t redirect_op_len(const string &s, size_t i) {
+    auto at = [&](size_t k, char ch) { return i + k < s.size() && s[i + k] == ch; };
+    if (at(0, '<')) {
+        if (at(1, '<')) return (at(2, '<') || at(2, '-')) ? 3 : 2;
+        return (at(1, '>') || at(1, '&')) ? 2 : 1;
+    }
+    if (at(0, '>')) return (at(1, '>') || at(1, '&')) ? 2 : 1;
+    if (at(0, '&') && at(1, '>')) return at(2, '>') ? 3 : 2;
+    return 0;
+}
+
+// Split a line into words in a single pass: handles '...' and "..." quoting,
+// backslash escapes, $NAME / ${NAME} expansion, $(cmd) / `cmd` substitution
+// <(cmd) / >(cmd) process substitution (recorded in info, the word gets its
+// path when run) and the | and & operators and redirections (which need no
+// surrounding spaces). A word of unquoted digits right before a redirection is its fd:
+// "2>" and "2>&" come out as single operator tokens.
+// If info is given, info->kinds and info->patterns are filled in parallel
+// with the tokens: each token's kind, and for a word containing unquoted *, ?
+// or [ its glob pattern (quoted characters backslash-escaped), "" otherwise.
+vector<string> parseInput(const string &input, LexInfo *info) {
+    vector<string> *used_vars = info ? &info->used_vars : nullptr;
+    vector<string> *patterns = info ? &info->patterns : nullptr;
+    vector<TokKind> *kinds = info ? &info->kinds : nullptr;
+    vector<string> tokens;
+    string word, pat;
+    bool in_word = false;       // true once the current word has started (even as "")
+    bool has_glob = false;
+    bool plain = true;          // no quoted, escaped or expanded characters so far
+    size_t plain_len = 0;       // length of the word's unquoted literal prefix
+    bool command_seen = false;  // a word other than NAME=value since the last operator
+    size_t i = 0, n = input.size();
+    // the current word is a NAME=value assignment (its value is not split)
+    auto assigning = [&]() {
+        size_t len = assignment_name_len(word);
+        return len && len < plain_len && !command_seen;
+    };
+    auto flush_word = [&]() {
+        if (in_word) {
+            size_t len = assignment_name_len(word);
+            bool assign = len && len < plain_len;
+            tokens.push_back(word);
+            if (patterns) patterns->push_back(has_glob ? pat : string());
+            if (kinds) kinds->push_back(assign ? TK_ASSIGN : TK_WORD);
+            if (!assign) command_seen = true;
+        }
+        word.clear();
+        pat.clear();
+        in_word = has_glob = false;
+        plain = true;
+        plain_len = 0;
+    };
+    auto op = [&](const string &text) {
+        flush_word();
+        if (text == "|" || text == "&") command_seen = false;
+        tokens.push_back(text);
+        if (patterns) patterns->push_back(string());
+        if (kinds) kinds->push_back(TK_OP);
+    };
+    // quoted/escaped/expanded characters never act as glob syntax
+    auto literal = [&](char ch) {
+        plain = false;
+        word += ch;
+        if (strchr("*?[]\\", ch)) pat += '\\';
+        pat += ch;
+    };
+    auto literal_str = [&](string_view str) { for (char ch : str) literal(ch); };
+    // Unquoted expansion: split on IFS into fields (separators at either
+    // end also end the word before or after it), whose * ? [ stay glob syntax.
+    // An assignment's value is neither split nor globbed.
+    auto fields = [&](string_view v) {
+        if (assigning()) {
+            literal_str(v);
+            return;
+        }
+        if (used_vars) used_vars->push_back("IFS");
+        plain = false;
+        vector<string_view> parts;
+        split_fields(v, parts);
+        if (parts.empty()) {
+            if (!v.empty()) flush_word();
+            return;
+        }
+        if (parts.front().data() != v.data()) flush_word();
+        for (size_t f = 0; f < parts.size(); ++f) {
+            if (f > 0) flush_word();
+            for (char ch : parts[f]) {
+                word += ch;
+                if (ch == '*' || ch == '?' || ch == '[') has_glob = true;
+                else if (ch == '\\') pat += '\\';
+                pat += ch;
+            }
+            in_word = true;
+        }
+        if (parts.back().end() != v.end()) flush_word();
+    };
+    // $@ / $*: one word per positional parameter, even inside quotes
+    auto all_params = [&]() {
+        if (used_vars) used_vars->push_back("@");
+        plain = false;
+        for (size_t k = 1; k < sh->positional_params.size(); ++k) {
+            if (k > 1) flush_word();
+            literal_str(sh->positional_params[k]);
+            in_word = true;
+        }
+        i += 2;
+    };
+    string expanded;
+    // $(cmd) / `cmd` at input[i]; unquoted output is split into fields
+    auto substitute = [&](bool quoted) {
+        if (info) info->has_substitution = true;
+        plain = false;
+        CaptureBuffer out;
+        capture_output(substitution_text(input, i), out);
+        string_view v = out.view();
+        while (!v.empty() && v.back() == '\n') v.remove_suffix(1);
+        if (quoted) literal_str(v);
+        else fields(v);
+    };
+    while (i < n) {
+        char c = input[i];
+        if (isspace((unsigned char)c)) {
+            flush_word();
+            ++i;
+        } else if (c == '#' && !in_word) {
+            break;              // comment to end of line
+        } else if ((c == '<' || c == '>') && i + 1 < n && input[i + 1] == '(') {
+            size_t end = find_subst_end(input, i + 2);
+            if (end == string::npos) end = n;
+            if (info) {
+                ProcSubst p;
+                p.offset = word.size();
+                p.output = c == '>';
+                p.text = input.substr(i + 2, end - i - 2);
+                info->substs.emplace_back(tokens.size(), std::move(p));
+            }
+            plain = false;
+            in_word = true;
+            i = end + 1;
+        } else if (size_t len = redirect_op_len(input, i)) {
+            string fd;
+            if (in_word && plain && c != '&' && !word.empty() &&
+                all_of(word.begin(), word.end(), [](char d) { return isdigit((unsigned char)d); })) {
+                fd.swap(word);
+                pat.clear();
+                in_word = false;
+            }
+            op(fd + input.substr(i, len));
+            i += len;
+        } else if (c == '|' || c == '&') {
+            op(c == '|' ? "|" : "&");
+            ++i;
+        } else if (c == '\'') {
+            size_t close = input.find('\'', i + 1);
+            if (close == string::npos) close = n;
+            literal_str(input.substr(i + 1, close - i - 1));
+            in_word = true;
+            i = close + 1;
+        } else if (c == '"') {
+            in_word = true;
+            ++i;
+            while (i < n && input[i] != '"') {
+                if (input[i] == '\\' && i + 1 < n && strchr("\"\\$`", input[i + 1])) {
+                    literal(input[i + 1]);
+                    i += 2;
+                } else if (input.compare(i, 2, "$(") == 0 || input[i] == '`') {
+                    substitute(true);
+                } else if (input.compare(i, 2, "$@") == 0) {
+                    all_params();
+                } else if (input[i] == '$') {
+                    ++i;
+                    expanded.clear();
+                    expand_param(input, i, expanded, info);
+                    literal_str(expanded);
+                } else {
+                    literal(input[i++]);
+                }
+            }
+            ++i;                // closing quote
+        } else if (c == '\\') {
+            if (i + 1 < n) literal(input[i + 1]);
+            in_word = true;
+            i += 2;
+        } else if (input.compare(i, 2, "$(") == 0 || c == '`') {
+            substitute(false);
+        } else if (input.compare(i, 2, "$@") == 0 || input.compare(i, 2, "$*") == 0) {
+            all_params();
+        } else if (c == '$') {
+            ++i;
+            expanded.clear();
+            expand_param(input, i, expanded, info);
+            fields(expanded);
+        } else {
+            if (c == '*' || c == '?' || c == '[') has_glob = true;
+            word += c;
+            pat += c;
+            in_word = true;
+            if (plain) plain_len = word.size();
+            ++i;
+        }
+    }
+    flush_word();
+    return tokens;
+}
+
+// ---- glob expansion ----
+// Directories are read with raw getdents64 and d_type, so matching never
+// stats an entry unless the filesystem leaves the type unknown (or it is a
+// symlink that has to be followed into). Listings are cached for the
+// duration of one command line, so "*.c *.h" reads the directory once.
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct DirEntry {
+    string name;
+    unsigned char type;     // DT_* from getdents64
+};
+
+class DirCache {
+public:
+    // entries of dir ("" = cwd), nullptr if it cannot be opened
+    const vector<DirEntry>* list(const string &dir) {
+        auto it = dirs_.find(dir);
+        if (it != dirs_.end()) return it->second.ok ? &it->second.entries : nullptr;
+        Listing &l = dirs_[dir];
+        int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) return nullptr;
+        l.ok = true;
+        vector<char> buf(256 * 1024);
+        while (true) {
+            long nread = syscall(SYS_getdents64, fd, buf.data(), buf.size());
+            if (nread <= 0) break;
+            for (long off = 0; off < nread;) {
+                auto *d = reinterpret_cast<linux_dirent64*>(buf.data() + off);
+                off += d->d_reclen;
+                if (d->d_name[0] == '.' && (d->d_name[1] == 0 || (d->d_name[1] == '.' && d->d_name[2] == 0)))
+                    continue;
+                l.entries.push_back(DirEntry{d->d_name, d->d_type});
+            }
+        }
+        close(fd);
+        return &l.entries;
+    }
+
+private:
+    struct Listing {
+        bool ok = false;
+        vector<DirEntry> entries;
+    };
+    unordered_map<string, Listing> dirs_;
+};
+
+// fnmatch-style match of one path component: *, ?, [...] / [!...], \x
+bool glob_match(const char *p, const char *s) {
+    const char *star_p = nullptr, *star_s = nullptr;
+    while (*s) {
+        if (*p == '*') {
+            star_p = ++p;
+            star_s = s;
+            continue;
+        }
+        bool ok = false;
+        const char *next = p + 1;
+        if (*p == '?') {
+            ok = true;
+        } else if (*p == '[') {
+            const char *q = p + 1;
+            bool negate = (*q == '!' || *q == '^');
+            if (negate) ++q;
+            bool found = false;
+            bool first = true;
+            while (*q && (first || *q != ']')) {
+                first = false;
+                char lo = *q;
+                if (lo == '\\' && q[1]) lo = *++q;
+                char hi = lo;
+                if (q[1] == '-' && q[2] && q[2] != ']') {
+                    hi = q[2];
+                    if (hi == '\\' && q[3]) { hi = q[3]; ++q; }
+                    q += 2;
+                }
+                if ((unsigned char)*s >= (unsigned char)lo && (unsigned char)*s <= (unsigned char)hi) found = true;
+                ++q;
+            }
+            if (*q == ']') {
+                ok = (found != negate);
+                next = q + 1;
+            } else {
+                ok = (*s == '[');       // unterminated: literal '['
+            }
+        } else if (*p == '\\' && p[1]) {
+            ok = (p[1] == *s);
+            next = p + 2;
+        } else {
+            ok = (*p == *s && *p);
+        }
+        if (ok) {
+            p = next;
+            ++s;
+        } else if (star_p) {
+            p = star_p;
+            s = ++star_s;
+        } else {
+            return false;
+        }
+    }
+    while (*p == '*') ++p;
+    return *p == 0;
+}
+
+static bool has_glob_chars(const string &seg) {
+    for (size_t i = 0; i < seg.size(); ++i) {
+        if (seg[i] == '\\') { ++i; continue; }
+        if (seg[i] == '*' || seg[i] == '?' || seg[i] == '[') return true;
+    }
+    return false;
+}
+
+static string glob_unescape(const string &seg) {
+    string out;
+    for (size_t i = 0; i < seg.size(); ++i) {
+        if (seg[i] == '\\' && i + 1 < seg.size()) ++i;
+        out += seg[i];
+    }
+    return out;
+}
+
+static bool entry_is_dir(const string &path, unsigned char type) {
+    if (type == DT_DIR) return true;
+    if (type != DT_UNKNOWN && type != DT_LNK) return false;
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// expand pattern segments [k..] below prefix ("" or ending in '/')
+static void glob_walk(const vector<string> &segs, size_t k, const string &prefix,
+                      DirCache &cache, vector<string> &out) {
+    if (k == segs.size()) {
+        out.push_back(prefix.empty() ? "." : prefix.substr(0, prefix.size() - 1));
+        return;
+    }
+    const string &seg = segs[k];
+    bool last = (k + 1 == segs.size());
+    string dir = prefix.empty() ? "" : prefix.substr(0, prefix.size() - 1);
+    if (dir.empty() && !prefix.empty()) dir = "/";
+    if (seg == "**") {
+        // zero directories ...
+        glob_walk(segs, k + 1, prefix, cache, out);
+        // ... or descend into every (non-hidden) subdirectory and stay on "**"
+        const vector<DirEntry> *ents = cache.list(dir);
+        if (!ents) return;
+        for (const auto &e : *ents) {
+            if (e.name[0] == '.') continue;
+            string path = prefix + e.name;
+            if (e.type == DT_DIR || (e.type == DT_UNKNOWN && entry_is_dir(path, e.type)))
+                glob_walk(segs, k, path + "/", cache, out);
+        }
+        return;
+    }
+    if (!has_glob_chars(seg)) {
+        string path = prefix + glob_unescape(seg);
+        if (last) {
+            if (access(path.c_str(), F_OK) == 0) out.push_back(path);
+        } else {
+            glob_walk(segs, k + 1, path + "/", cache, out);
+        }
+        return;
+    }
+    const vector<DirEntry> *ents = cache.list(dir);
+    if (!ents) return;
+    bool dot_ok = (seg[0] == '.');
+    for (const auto &e : *ents) {
+        if (e.name[0] == '.' && !dot_ok) continue;
+        if (!glob_match(seg.c_str(), e.name.c_str())) continue;
+        string path = prefix + e.name;
+        if (last) out.push_back(path);
+        else if (entry_is_dir(path, e.type)) glob_walk(segs, k + 1, path + "/", cache, out);
+    }
+}
+
+// MSD radix sort on byte strings (C-locale order), insertion sort for small buckets
+static inline int radix_byte(const string *s, size_t d) {
+    return d < s->size() ? (unsigned char)(*s)[d] + 1 : 0;
+}
+
+static void msd_radix_sort(const string **a, const string **tmp, size_t n, size_t d) {
+    if (n < 32) {
+        for (size_t i = 1; i < n; ++i) {
+            const string *v = a[i];
+            size_t j = i;
+            while (j > 0 && a[j - 1]->compare(d, string::npos, *v, d, string::npos) > 0) {
+                a[j] = a[j - 1];
+                --j;
+            }
+            a[j] = v;
+        }
+        return;
+    }
+    size_t count[258];
+    while (true) {
+        memset(count, 0, sizeof(count));
+        for (size_t i = 0; i < n; ++i) ++count[radix_byte(a[i], d) + 1];
+        // shared prefix byte (typical for paths): step over it without moving anything
+        int b = radix_byte(a[0], d);
+        if (b == 0 || count[b + 1] != n) break;
+        ++d;
+    }
+    for (int b = 1; b < 258; ++b) count[b] += count[b - 1];
+    for (size_t i = 0; i < n; ++i) tmp[count[radix_byte(a[i], d)]++] = a[i];
+    memcpy(a, tmp, n * sizeof(*a));
+    // count[b] is now the end of bucket b; bucket 0 (ended strings) is done
+    for (int b = 1; b < 257; ++b) {
+        size_t start = count[b - 1], len = count[b] - start;
+        if (len > 1) msd_radix_sort(a + start, tmp, len, d + 1);
+    }
+}
+
+void radix_sort(vector<string> &v) {
+    if (v.size() < 2) return;
+    vector<const string*> ptrs(v.size()), tmp(v.size());
+    for (size_t i = 0; i < v.size(); ++i) ptrs[i] = &v[i];
+    msd_radix_sort(ptrs.data(), tmp.data(), v.size(), 0);
+    vector<string> sorted;
+    sorted.reserve(v.size());
+    for (const string *p : ptrs) sorted.push_back(std::move(*const_cast<string*>(p)));
+    v.swap(sorted);
+}
+
+// Expand one pattern; no match leaves the (unescaped) word as typed.
+vector<string> expand_glob(const string &pattern, DirCache &cache) {
+    vector<string> segs;
+    string prefix;
+    size_t start = 0;
+    if (!pattern.empty() && pattern[0] == '/') {
+        prefix = "/";
+        start = 1;
+    }
+    while (start <= pattern.size()) {
+        size_t slash = pattern.find('/', start);
+        if (slash == string::npos) slash = pattern.size();
+        if (slash > start) segs.push_back(pattern.substr(start, slash - start));
+        start = slash + 1;
+    }
+    vector<string> out;
+    if (!segs.empty()) glob_walk(segs, 0, prefix, cache, out);
+    if (out.empty()) {
+        out.push_back(glob_unescape(pattern));
+        return out;
+    }
+    radix_sort(out);
+    return out;
+}
+
+// ---- job table ----
+
+static int64_t monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// a job record (not in the table yet): every process is a stage still running
+Job new_job(pid_t pgid, const vector<pid_t> &pids, const string &cmd, JobStatus status) {
+    Job j{0, pgid, pids, cmd, status, pids.empty() ? pgid : pids.back()};
+    j.stages = pids;
+    j.stage_status.assign(pids.size(), -1);
+    j.started_ms = monotonic_ms();
+    return j;
+}
+
+Job &add_job(Job j) {
+    j.jid = sh->next_jid++;
+    sh->jobs.push_back(std::move(j));
+    return sh->jobs.back();
+}
+
+Job &add_job(pid_t pgid, const vector<pid_t> &pids, const string &cmd, JobStatus status) {
+    return add_job(new_job(pgid, pids, cmd, status));
+}
+
+// helper: find job by jid or pgid or pid
+Job* find_job_by_jid(int jid) {
+    for (auto &j : sh->jobs) if (j.jid == jid) return &j;
+    return nullptr;
+}
+Job* find_job_by_pgid(pid_t pgid) {
+    for (auto &j : sh->jobs) if (j.pgid == pgid) return &j;
+    return nullptr;
+}
+Job* find_job_by_pid(pid_t pid) {
+    for (auto &j : sh->jobs)
+        if (find(j.pids.begin(), j.pids.end(), pid) != j.pids.end()) return &j;
+    pid_t pg = getpgid(pid);
+    if (pg < 0) return nullptr;
+    return find_job_by_pgid(pg);
+}
+
+// A process of j exited with status (as from wait4, with its rusage): record
+// its stage's exit status and add its resource use to the job's, then drop
+// it from pids. Returns true when the whole job is gone.
+bool job_reap_pid(Job &j, pid_t pid, int status, const struct rusage &ru) {
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    if (pid == j.last_pid) j.exit_status = code;
+    for (size_t k = 0; k < j.stages.size(); ++k)
+        if (j.stages[k] == pid) j.stage_status[k] = code;
+    j.utime_us += ru.ru_utime.tv_sec * 1000000L + ru.ru_utime.tv_usec;
+    j.stime_us += ru.ru_stime.tv_sec * 1000000L + ru.ru_stime.tv_usec;
+    j.maxrss_kb = max(j.maxrss_kb, ru.ru_maxrss);
+    j.pids.erase(remove(j.pids.begin(), j.pids.end(), pid), j.pids.end());
+    if (!j.pids.empty()) return false;
+    j.ended_ms = monotonic_ms();
+    if (sh->opt_pipefail) {
+        // the last stage that failed, 0 if none did
+        j.exit_status = 0;
+        for (int st : j.stage_status) if (st > 0) j.exit_status = st;
+    }
+    return true;
+}
+
+// a job has finished: keep its status for "wait" (bounded, like CHILD_MAX)
+static void remember_done_job(const Job &j) {
+    const size_t keep = 1024;
+    if (sh->done_jobs.size() >= keep) sh->done_jobs.erase(sh->done_jobs.begin());
+    sh->done_jobs.push_back(j);
+}
+
+void end_coproc(pid_t pgid);
+
+void remove_job_by_pgid(pid_t pgid) {
+    if (!sh->coprocs.empty()) end_coproc(pgid);
+    sh->jobs.erase(remove_if(sh->jobs.begin(), sh->jobs.end(),
+                         [pgid](const Job &j){ return j.pgid == pgid; }),
+               sh->jobs.end());
+}
+
+static const char *job_state(const Job &j) {
+    return (j.status == RUNNING) ? "Running" : (j.status == STOPPED) ? "Stopped" : "Done";
+}
+
+void print_jobs() {
+    for (const auto &j : sh->jobs) {
+        std_out << "[" << j.jid << "] " << j.pgid << " " << job_state(j);
+        if (!j.reason.empty()) std_out << " (" << j.reason << ")";
+        std_out << "    " << j.cmd << "\n";
+    }
+}
+
+// The jobs listed with their resource use: the table, then jobs that
+// finished since the last such listing (each is summarized once, so a
+// monitor polling "jobs --json" sees every job's end exactly once).
+static vector<const Job *> jobs_to_summarize() {
+    vector<const Job *> list;
+    for (const auto &j : sh->jobs) list.push_back(&j);
+    for (auto &j : sh->done_jobs) {
+        if (j.summarized) continue;
+        j.summarized = true;
+        list.push_back(&j);
+    }
+    return list;
+}
+
+// jobs -l / --stats: elapsed, CPU, peak RSS and the exit status of each stage
+void print_job_stats() {
+    int64_t now = monotonic_ms();
+    for (const Job *j : jobs_to_summarize()) {
+        int64_t elapsed = (j->ended_ms ? j->ended_ms : now) - j->started_ms;
+        char stats[128];
+        snprintf(stats, sizeof(stats), "%.2fs real  %.2fs user  %.2fs sys  %ldK rss",
+                 elapsed / 1e3, j->utime_us / 1e6, j->stime_us / 1e6, j->maxrss_kb);
+        std_out << "[" << j->jid << "] " << j->pgid << " " << (j->ended_ms ? "Done" : job_state(*j));
+        if (!j->reason.empty()) std_out << " (" << j->reason << ")";
+        std_out << "    " << stats << "  exit ";
+        for (size_t k = 0; k < j->stage_status.size(); ++k) {
+            if (k) std_out << '|';
+            if (j->stage_status[k] < 0) std_out << '-';
+            else std_out << j->stage_status[k];
+        }
+        std_out << "    " << j->cmd << "\n";
+    }
+}
+
+static void json_string(const string &s) {
+    std_out << '"';
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            std_out << '\\' << (char)c;
+        } else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            std_out << esc;
+        } else {
+            std_out << (char)c;
+        }
+    }
+    std_out << '"';
+}
+
+// jobs --json: the same, one object per line; null for what is not known yet
+void print_jobs_json() {
+    int64_t now = monotonic_ms();
+    for (const Job *j : jobs_to_summarize()) {
+        const char *state = j->ended_ms ? "done" : j->status == STOPPED ? "stopped" : "running";
+        std_out << "{\"jid\":" << j->jid << ",\"pgid\":" << j->pgid << ",\"state\":\"" << state << "\",\"cmd\":";
+        json_string(j->cmd);
+        std_out << ",\"reason\":";
+        json_string(j->reason);
+        std_out << ",\"elapsed_ms\":" << (j->ended_ms ? j->ended_ms : now) - j->started_ms
+                << ",\"utime_us\":" << j->utime_us << ",\"stime_us\":" << j->stime_us
+                << ",\"maxrss_kb\":" << j->maxrss_kb << ",\"exit_status\":";
+        if (j->ended_ms) std_out << j->exit_status;
+        else std_out << "null";
+        std_out << ",\"stages\":[";
+        for (size_t k = 0; k < j->stages.size(); ++k) {
+            std_out << (k ? ",{" : "{") << "\"pid\":" << j->stages[k] << ",\"status\":";
+            if (j->stage_status[k] < 0) std_out << "null";
+            else std_out << j->stage_status[k];
+            std_out << '}';
+        }
+        std_out << "]}\n";
+    }
+}
+
+// ---- job output logs ----
+// With "set -o joblog", a background job's stdout and stderr go into a pipe
+// owned by the shell instead of the terminal. At the prompt the event loop
+// splices whatever arrives into the job's ring: a memfd of JOBLOG_SIZE
+// bytes (default 1M) written at offset total % size, so the output never
+// passes through user space and only the most recent part is kept. Logs
+// outlive their jobs, for "joblog %n" after Done. All rings together stay
+// within JOBLOG_MAX (default 16M): the oldest logs of finished jobs are
+// dropped to make room, and a job that still does not fit is not captured.
+
+static uint64_t joblog_setting(const char *name, uint64_t fallback) {
+    const string *v = sh->env.get(name);
+    uint64_t n = v ? parse_size(*v) : 0;
+    return n ? n : fallback;
+}
+
+JobLog *find_job_log(int jid) {
+    for (auto &l : sh->job_logs) if (l.jid == jid) return &l;
+    return nullptr;
+}
+
+static void close_job_log(JobLog &l) {
+    if (l.pipe_fd >= 0) close(l.pipe_fd);
+    if (l.ring_fd >= 0) close(l.ring_fd);
+}
+
+// Before forking a background job: a ring for it and the pipe feeding it.
+// Returns the write end for the job's stdout/stderr, or -1 when not
+// capturing. The log is registered under the job's id by finish_job.
+int open_job_log(const string &cmd) {
+    if (!sh->opt_joblog) return -1;
+    uint64_t size = joblog_setting("JOBLOG_SIZE", 1 << 20);
+    uint64_t max = joblog_setting("JOBLOG_MAX", 16 << 20);
+    uint64_t reserved = 0;
+    for (const auto &l : sh->job_logs) reserved += l.capacity;
+    for (auto it = sh->job_logs.begin(); reserved + size > max && it != sh->job_logs.end();) {
+        if (it->pipe_fd >= 0 || find_job_by_jid(it->jid)) { ++it; continue; }
+        reserved -= it->capacity;
+        close_job_log(*it);
+        it = sh->job_logs.erase(it);
+    }
+    if (reserved >= max) return -1;
+    size = min(size, max - reserved);
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) return -1;
+    int ring = memfd_create("joblog", MFD_CLOEXEC);
+    if (ring < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    // nothing drains the pipe while a foreground command runs: let it hold
+    // up to a ring's worth (capped by fs.pipe-max-size) before the job blocks
+    fcntl(fds[0], F_SETPIPE_SZ, (int)min<uint64_t>(size, 1 << 30));
+    sh->job_logs.push_back(JobLog{0, cmd, fds[0], ring, size});
+    return fds[1];
+}
+
+// the job was not started after all
+void cancel_job_log() {
+    if (!sh->job_logs.empty() && sh->job_logs.back().jid == 0) {
+        close_job_log(sh->job_logs.back());
+        sh->job_logs.pop_back();
+    }
+}
+
+// Move what is in the pipe into the ring; with echo_fd >= 0 the new data is
+// also copied there (fg shows a captured job's output live).
+void drain_job_log(JobLog &l, int echo_fd = -1) {
+    char buf[16384];
+    while (l.pipe_fd >= 0) {
+        loff_t off = l.written % l.capacity;
+        size_t room = l.capacity - off;
+        ssize_t n = splice(l.pipe_fd, nullptr, l.ring_fd, &off, room, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+        if (n < 0 && errno == EINVAL) {
+            // no splice into this file: copy through user space
+            n = read(l.pipe_fd, buf, min(room, sizeof(buf)));
+            if (n > 0) n = pwrite(l.ring_fd, buf, n, off);
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return;
+        if (n <= 0) {
+            // every writer is gone (or the ring failed): stop watching
+            close(l.pipe_fd);
+            l.pipe_fd = -1;
+            return;
+        }
+        if (echo_fd >= 0) {
+            uint64_t from = l.written % l.capacity;
+            for (ssize_t done = 0; done < n;) {
+                ssize_t r = pread(l.ring_fd, buf, min((size_t)(n - done), sizeof(buf)), from + done);
+                if (r <= 0 || write(echo_fd, buf, r) < 0) break;
+                done += r;
+            }
+        }
+        l.written += n;
+    }
+}
+
+void drain_job_logs() {
+    for (auto &l : sh->job_logs) drain_job_log(l);
+}
+
+// the part of the log still in the ring, oldest byte first
+static string read_job_log(const JobLog &l) {
+    uint64_t kept = min(l.written, l.capacity);
+    string text(kept, '\0');
+    uint64_t start = l.written > l.capacity ? l.written % l.capacity : 0;
+    uint64_t first = min(kept, l.capacity - start);
+    if (pread(l.ring_fd, &text[0], first, start) != (ssize_t)first) return string();
+    if (kept > first && pread(l.ring_fd, &text[first], kept - first, 0) != (ssize_t)(kept - first)) return string();
+    return text;
+}
+
+// where the last `lines` lines of text begin
+static size_t tail_start(const string &text, long lines) {
+    if (lines <= 0) return text.size();
+    size_t pos = text.size();
+    if (pos && text[pos - 1] == '\n') --pos;     // the final newline ends the last line
+    while (pos > 0) {
+        size_t nl = text.rfind('\n', pos - 1);
+        if (nl == string::npos) return 0;
+        if (--lines == 0) return nl + 1;
+        pos = nl;
+    }
+    return 0;
+}
+
+// joblog              list captured logs
+// joblog [-n N] [%n]  print a job's log (default: the newest), or its last N lines
+int builtin_joblog(const vector<string> &argv) {
+    drain_job_logs();       // scripts have no prompt loop doing it
+    long lines = -1;
+    size_t k = 1;
+    if (k + 1 < argv.size() && argv[k] == "-n") {
+        lines = atol(argv[k + 1].c_str());
+        k += 2;
+    }
+    if (k == argv.size() && lines < 0) {
+        for (const auto &l : sh->job_logs) {
+            if (!l.jid) continue;
+            std_out << "[" << l.jid << "] " << l.written << " bytes";
+            if (l.written > l.capacity) std_out << " (" << l.written - l.capacity << " dropped)";
+            std_out << (l.pipe_fd >= 0 ? "  open    " : "  closed  ") << l.cmd << "\n";
+        }
+        return 0;
+    }
+    const JobLog *log = nullptr;
+    if (k < argv.size()) {
+        int jid = parse_job_token(argv[k]);
+        if (!jid) jid = atoi(argv[k].c_str());
+        log = find_job_log(jid);
+    } else {
+        for (const auto &l : sh->job_logs) if (l.jid) log = &l;
+    }
+    if (!log) {
+        std_err << "joblog: " << (k < argv.size() ? argv[k] : string("%+")) << ": no such log\n";
+        return 1;
+    }
+    string text = read_job_log(*log);
+    size_t from = lines >= 0 ? tail_start(text, lines) : 0;
+    std_out << string_view(text).substr(from);
+    return 0;
+}
+
+// reap and update job statuses (called whenever the SIGCHLD signalfd fires,
+// including while the user is sitting at the prompt); notify: print the
+// changes, which only an interactive shell does
+void update_jobs(bool notify = true) {
+    notify = notify && sh->interactive;
+    int status;
+    pid_t pid;
+    struct rusage ru;
+    // loop - handle exited/stopped/continued children
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru)) > 0) {
+        Job *j = find_job_by_pid(pid);
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (j && job_reap_pid(*j, pid, status, ru)) {
+                // last process of the group is gone - notify and drop the job
+                if (JobLog *l = find_job_log(j->jid)) drain_job_log(*l);
+                if (sh->deadlines.finish(j->pgid)) j->exit_status = 124;
+                if (notify) {
+                    std_out << "[" << j->jid << "] " << j->pgid << " Done";
+                    if (!j->reason.empty()) std_out << " (" << j->reason << ")";
+                    std_out << "    " << j->cmd << "\n";
+                }
+                remember_done_job(*j);
+                remove_job_by_pgid(j->pgid);
+            }
+            // otherwise: orphan child or job still has live members - no-op
+        } else if (WIFSTOPPED(status)) {
+            if (j && j->status != STOPPED) {
+                j->status = STOPPED;
+                if (notify) std_out << "[" << j->jid << "] " << j->pgid << " Stopped    " << j->cmd << "\n";
+            }
+        } else if (WIFCONTINUED(status)) {
+            if (j && j->status != RUNNING) {
+                j->status = RUNNING;
+                if (notify) std_out << "[" << j->jid << "] " << j->pgid << " Continued    " << j->cmd << "\n";
+            }
+        }
+    }
+    std_out.flush();
+}
+
+// SIGCHLD is blocked and delivered through a signalfd, so children are
+// reaped as soon as they change state, even while waiting for input. Set up
+// on the first prompt: -c and scripts never wait for input and skip it.
+static void watch_children() {
+    sh->watching_children = true;
+    sigemptyset(&sigchld_mask);
+    sigaddset(&sigchld_mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &sigchld_mask, nullptr);
+    sh->sigchld_fd = signalfd(-1, &sigchld_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sh->sigchld_fd < 0) perror("signalfd");
+    sh->sigchld_fd = high_fd(sh->sigchld_fd);
+}
+
+// discard queued SIGCHLD notifications; returns true if there were any
+bool drain_sigchld_fd() {
+    bool got = false;
+    struct signalfd_siginfo si;
+    while (read(sh->sigchld_fd, &si, sizeof(si)) == (ssize_t)sizeof(si)) got = true;
+    return got;
+}
+
+// ---- timeout ----
+// timeout [-k GRACE] DURATION cmd... runs a line with a deadline on its job:
+// SIGTERM (and SIGCONT, in case it is stopped) to the process group when
+// it expires, SIGKILL if it is still there GRACE (default 5s) later. The job
+// then ends with status 124 and shows "timed out" in jobs. The deadline
+// covers the whole pipeline, which gets a process group of its own even
+// without job control, like timeout(1) does. timeout DURATION %n puts a
+// deadline on a job that is already running. Words after "timeout" that do
+// not fit this form leave the line to the timeout(1) program.
+
+// "1.5", "10s", "500ms", "2m", "1h", "1d" -> milliseconds; -1 if malformed
+int64_t parse_duration(const string &text) {
+    char *end = nullptr;
+    double n = strtod(text.c_str(), &end);
+    if (end == text.c_str() || n < 0 || !isdigit((unsigned char)text[0])) return -1;
+    string unit(end);
+    double scale = unit.empty() || unit == "s" ? 1000 : unit == "ms" ? 1 : unit == "m" ? 60000 :
+                   unit == "h" ? 3600000 : unit == "d" ? 86400000 : -1;
+    return scale < 0 ? -1 : (int64_t)(n * scale);
+}
+
+struct JobTimeout {
+    int64_t ms;
+    int64_t grace_ms = 5000;
+};
+
+// strip a "timeout [-k GRACE] DURATION" prefix from cmd; false if it has none
+bool take_timeout(Command &cmd, JobTimeout &t) {
+    const vector<string> &argv = cmd.argv;
+    if (argv.empty() || argv[0] != "timeout") return false;
+    size_t k = 1;
+    if (k + 1 < argv.size() && argv[k] == "-k") {
+        t.grace_ms = parse_duration(argv[k + 1]);
+        if (t.grace_ms < 0) return false;
+        k += 2;
+    }
+    if (k + 1 >= argv.size() || (t.ms = parse_duration(argv[k])) < 0) return false;
+    cmd.argv.erase(cmd.argv.begin(), cmd.argv.begin() + k + 1);
+    cmd.exec_path = resolve_path(cmd.argv[0]);
+    return true;
+}
+
+void arm_deadline(pid_t pgid, const JobTimeout &t) {
+    // waiting for the job has to wake up for the timer as well as SIGCHLD
+    if (!sh->watching_children) watch_children();
+    sh->deadlines.add(pgid, monotonic_ms() + t.ms, t.grace_ms);
+}
+
+// signal the jobs whose deadline has come (the timerfd fired)
+void run_deadlines() {
+    sh->deadlines.acknowledge();
+    int64_t now = monotonic_ms();
+    pid_t pgid;
+    int sig;
+    while (sh->deadlines.due(now, pgid, sig)) {
+        Job *j = find_job_by_pgid(pgid);
+        // without job control a background job stays in the shell's group:
+        // signal its processes one by one
+        bool own_group = kill(-pgid, sig) == 0 || errno != ESRCH || !j;
+        if (own_group) {
+            if (sig == SIGTERM) kill(-pgid, SIGCONT);
+        } else {
+            for (pid_t pid : j->pids) {
+                kill(pid, sig);
+                if (sig == SIGTERM) kill(pid, SIGCONT);
+            }
+        }
+        if (j) j->reason = sig == SIGTERM ? "timed out" : "timed out, killed";
+    }
+}
+
+// timeout [-k GRACE] DURATION %n
+int set_job_deadline(const string &arg, const JobTimeout &t) {
+    Job *j = find_job_arg(arg);
+    if (!j) {
+        std_err << "timeout: " << arg << ": no such job\n";
+        return 1;
+    }
+    arm_deadline(j->pgid, t);
+    return 0;
+}
+
+// ---- line reader ----
+// In interactive mode the terminal is put in non-canonical mode while the
+// prompt is up, so the shell owns the partially typed line and can reprint
+// it after writing job notifications above it.
+
+static string input_pending;   // bytes read from stdin but not consumed yet
+static bool input_eof = false;
+
+static void write_str(const string &s) {
+    std_out << s;
+    std_out.flush();
+}
+
+static void redraw_line(const string &prompt, const string &buf) {
+    write_str("\r\033[K" + prompt + buf);
+}
+
+// wait until stdin has data, reaping children in the meantime
+// returns false on EOF/error
+static bool fill_input(const string &prompt, const string &buf) {
+    while (true) {
+        // stdin, SIGCHLD, job deadlines, then the pipes of captured jobs
+        vector<struct pollfd> pfd;
+        pfd.push_back({STDIN_FILENO, POLLIN, 0});
+        pfd.push_back({sh->sigchld_fd, POLLIN, 0});
+        pfd.push_back({sh->deadlines.fd(), POLLIN, 0});
+        for (const auto &l : sh->job_logs)
+            if (l.pipe_fd >= 0) pfd.push_back({l.pipe_fd, POLLIN, 0});
+        int r = poll(pfd.data(), pfd.size(), -1);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (pfd[2].revents) run_deadlines();
+        for (size_t k = 3; k < pfd.size(); ++k)
+            if (pfd[k].revents) { drain_job_logs(); break; }
+        if (sh->sigchld_fd >= 0 && (pfd[1].revents & POLLIN)) {
+            drain_sigchld_fd();
+            if (sh->interactive) write_str("\r\033[K");
+            update_jobs();
+            if (sh->interactive) redraw_line(prompt, buf);
+        }
+        if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            char chunk[4096];
+            ssize_t n = read(STDIN_FILENO, chunk, sizeof(chunk));
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                return false;
+            }
+            if (n == 0) return false;
+            input_pending.append(chunk, n);
+            return true;
+        }
+    }
+}
+
+// non-interactive: plain line splitting of stdin
+static bool read_plain_line(string &line) {
+    line.clear();
+    while (true) {
+        size_t nl = input_pending.find('\n');
+        if (nl != string::npos) {
+            line = input_pending.substr(0, nl);
+            input_pending.erase(0, nl + 1);
+            return true;
+        }
+        if (input_eof || !fill_input("", "")) {
+            input_eof = true;
+            if (input_pending.empty()) return false;
+            line.swap(input_pending);
+            input_pending.clear();
+            return true;
+        }
+    }
+}
+
+// interactive: minimal editor (backspace, ^U, ^W, ^C, ^D, enter)
+static bool read_tty_line(const string &prompt, string &line) {
+    struct termios raw = sh->shell_tmodes;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+    string buf;
+    bool ok = true;
+    write_str(prompt);
+    while (true) {
+        if (input_pending.empty() && !fill_input(prompt, buf)) {
+            ok = !buf.empty();
+            write_str("\n");
+            break;
+        }
+        unsigned char c = input_pending[0];
+        input_pending.erase(0, 1);
+        if (c == '\r' || c == '\n') {
+            write_str("\n");
+            break;
+        } else if (c == 4) {                    // ^D
+            if (buf.empty()) { ok = false; write_str("\n"); break; }
+        } else if (c == 3) {                    // ^C - drop the line
+            write_str("^C\n");
+            buf.clear();
+            write_str(prompt);
+        } else if (c == 127 || c == 8) {        // backspace
+            if (!buf.empty()) { buf.pop_back(); write_str("\b \b"); }
+        } else if (c == 21) {                   // ^U
+            buf.clear();
+            redraw_line(prompt, buf);
+        } else if (c == 23) {                   // ^W
+            while (!buf.empty() && buf.back() == ' ') buf.pop_back();
+            while (!buf.empty() && buf.back() != ' ') buf.pop_back();
+            redraw_line(prompt, buf);
+        } else if (c == 27) {                   // escape sequence (arrows etc.) - ignored
+            if (input_pending.size() >= 2 && input_pending[0] == '[') input_pending.erase(0, 2);
+        } else if (c >= 32) {
+            buf.push_back((char)c);
+            std_out.put((char)c).flush();
+        }
+    }
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &sh->shell_tmodes);
+    line = buf;
+    return ok;
+}
+
+bool read_line(const string &prompt, string &line) {
+    // pick up anything that finished while the previous command was running
+    if (!sh->watching_children) {
+        watch_children();
+        update_jobs();
+    } else if (sh->sigchld_fd >= 0 && drain_sigchld_fd()) {
+        update_jobs();
+    }
+    drain_job_logs();
+    if (sh->interactive) return read_tty_line(prompt, line);
+    write_str(prompt);
+    return read_plain_line(line);
+}
+
+bool is_redirect_token(const string &tk) {
+    size_t k = 0;
+    while (k < tk.size() && isdigit((unsigned char)tk[k])) ++k;
+    return k < tk.size() && redirect_op_len(tk, k) == tk.size() - k;
+}
+
+// Append the redirection for operator token op (as produced by parseInput,
+// with an optional fd prefix) and its target word.
+void add_redirect(const string &op, const string &target, vector<Redirect> &out) {
+    size_t k = 0;
+    while (k < op.size() && isdigit((unsigned char)op[k])) ++k;
+    string sym = op.substr(k);
+    int fd = k ? atoi(op.substr(0, k).c_str()) : (sym[0] == '<' ? STDIN_FILENO : STDOUT_FILENO);
+    bool numeric = !target.empty() && all_of(target.begin(), target.end(),
+                                             [](char d) { return isdigit((unsigned char)d); });
+    if (sym == "&>" || sym == "&>>" || (sym == ">&" && !numeric && target != "-")) {
+        // &>file, >&file: stdout and stderr to the same file
+        out.push_back(Redirect{STDOUT_FILENO, sym == "&>>" ? R_APPEND : R_WRITE, target});
+        out.push_back(Redirect{STDERR_FILENO, R_DUP, "1"});
+    } else if (sym == ">&" || sym == "<&") {
+        out.push_back(Redirect{fd, target == "-" ? R_CLOSE : R_DUP, target});
+    } else if (sym == "<<" || sym == "<<-") {
+        out.push_back(Redirect{fd, R_HERE, target});
+    } else if (sym == "<<<") {
+        out.push_back(Redirect{fd, R_HERE, target + "\n"});
+    } else {
+        RedirOp o = sym == "<" ? R_READ : sym == ">>" ? R_APPEND : sym == "<>" ? R_READWRITE : R_WRITE;
+        out.push_back(Redirect{fd, o, target});
+    }
+}
+
+// With info (from parseInput) the tokens' kinds decide what is syntax; tokens
+// without it (Shell::plan) are told apart by their text.
+vector<Command> buildCommands(const vector<string>& tokens, const LexInfo *info = nullptr) {
+    const vector<string> *patterns = info ? &info->patterns : nullptr;
+    const vector<pair<size_t, ProcSubst>> *substs = info ? &info->substs : nullptr;
+    auto is_op = [&](size_t k) { return info ? info->kinds[k] == TK_OP : true; };
+    vector<Command> cmds;
+    cmds.emplace_back();
+    // attach the substitutions lexed in token tk to the word it became
+    size_t next_subst = 0;
+    auto place_substs = [&](size_t tk, bool redirect, size_t index) {
+        for (; substs && next_subst < substs->size() && (*substs)[next_subst].first <= tk; ++next_subst) {
+            if ((*substs)[next_subst].first < tk) continue;     // in a NAME=value prefix
+            ProcSubst p = (*substs)[next_subst].second;
+            p.redirect = redirect;
+            p.index = index;
+            cmds.back().substs.push_back(std::move(p));
+        }
+    };
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        const string &tk = tokens[i];
+        if (tk == "|" && is_op(i)) {
+            // start new command
+            cmds.emplace_back();
+        } else if (is_op(i) && is_redirect_token(tk)) {
+            // a heredoc body was already turned into one word by the parser
+            if (i + 1 < tokens.size()) {
+                place_substs(i + 1, true, cmds.back().redirs.size());
+                add_redirect(tk, tokens[++i], cmds.back().redirs);
+            }
+        } else if (cmds.back().argv.empty() && (info ? info->kinds[i] == TK_ASSIGN : assignment_name_len(tk) > 0)) {
+            // VAR=val before the command name applies to that command only
+            cmds.back().assigns.push_back(tk);
+        } else {
+            if (patterns && !(*patterns)[i].empty())
+                cmds.back().globs.emplace_back(cmds.back().argv.size(), (*patterns)[i]);
+            place_substs(i, false, cmds.back().argv.size());
+            cmds.back().argv.push_back(tk);
+        }
+    }
+    // remove any empty trailing command (e.g., trailing pipe)
+    if (!cmds.empty() && cmds.back().argv.empty() && cmds.back().assigns.empty() && !cmds.back().redirected()) {
+        cmds.pop_back();
+    }
+    return cmds;
+}
+
+bool needs_glob(const vector<Command> &cmds) {
+    for (const auto &c : cmds) if (!c.globs.empty()) return true;
+    return false;
+}
+
+bool needs_substs(const vector<Command> &cmds) {
+    for (const auto &c : cmds) if (!c.substs.empty()) return true;
+    return false;
+}
+
+// replace glob words in argv; one directory cache is shared by the whole line
+void expandGlobs(vector<Command> &cmds) {
+    DirCache cache;
+    for (auto &c : cmds) {
+        // back to front so earlier argv indices stay valid
+        for (auto g = c.globs.rbegin(); g != c.globs.rend(); ++g) {
+            vector<string> matches = expand_glob(g->second, cache);
+            auto pos = c.argv.erase(c.argv.begin() + g->first);
+            c.argv.insert(pos, make_move_iterator(matches.begin()), make_move_iterator(matches.end()));
+        }
+        c.globs.clear();
+    }
+}
+
+struct Builtin;
+const Builtin* find_builtin(const string &name);
+
+bool is_builtin(const string &name) {
+    return find_builtin(name) != nullptr;
+}
+
+// PATH lookup done once per compiled line instead of by execvp in every child.
+// Relative PATH entries (".", "bin") are skipped so the result does not depend
+// on the cwd; such commands are left to execvp.
+string resolve_path(const string &name) {
+    if (name.empty() || name.find('/') != string::npos || is_builtin(name)) return "";
+    const string *path = sh->env.get("PATH");
+    if (!path) return "";
+    const string &dirs = *path;
+    size_t start = 0;
+    while (start <= dirs.size()) {
+        size_t end = dirs.find(':', start);
+        if (end == string::npos) end = dirs.size();
+        string dir = dirs.substr(start, end - start);
+        start = end + 1;
+        if (dir.empty() || dir[0] != '/') continue;
+        string full = dir + "/" + name;
+        struct stat st;
+        if (stat(full.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(full.c_str(), X_OK) == 0)
+            return full;
+    }
+    return "";
+}
+
+void resolveCommands(vector<Command> &cmds) {
+    for (auto &c : cmds)
+        if (!c.argv.empty()) c.exec_path = resolve_path(c.argv[0]);
+}
+
+// tokenize, build and resolve a line, going through the cache; lines whose
+// words come from command substitution are compiled into scratch instead
+CompiledLine* compile_line(const string &input, CompiledLine &scratch) {
+    if (CompiledLine *hit = sh->cmd_cache.lookup(input)) return hit;
+
+    CompiledLine c;
+    LexInfo info;
+    c.tokens = parseInput(input, &info);
+    // a trailing & operator runs the line in the background
+    if (!c.tokens.empty() && info.kinds.back() == TK_OP && c.tokens.back() == "&") {
+        c.background = true;
+        c.tokens.pop_back();
+        info.kinds.pop_back();
+        info.patterns.pop_back();
+    }
+    c.cmds = buildCommands(c.tokens, &info);
+    resolveCommands(c.cmds);
+    c.failed = info.failed;
+    if (info.has_substitution || info.assigns || info.failed) {
+        scratch = std::move(c);
+        return &scratch;
+    }
+    vector<string> &used_vars = info.used_vars;
+    used_vars.push_back("PATH");
+    sort(used_vars.begin(), used_vars.end());
+    used_vars.erase(unique(used_vars.begin(), used_vars.end()), used_vars.end());
+    for (const auto &name : used_vars) c.deps.emplace_back(name, param_value(name));
+    return sh->cmd_cache.insert(input, std::move(c));
+}
+
+// Build an envp of pointers: the overrides followed by every base entry
+// they do not shadow. Only the pointer array is allocated, no strings copied.
+char **layer_env(char **base, vector<string> &overrides) {
+    static vector<char*> layered;
+    layered.clear();
+    for (auto &o : overrides) layered.push_back(&o[0]);
+    for (char **e = base; *e; ++e) {
+        bool shadowed = false;
+        for (const auto &o : overrides) {
+            size_t len = assignment_name_len(o) + 1;   // include '='
+            if (strncmp(*e, o.c_str(), len) == 0) { shadowed = true; break; }
+        }
+        if (!shadowed) layered.push_back(*e);
+    }
+    layered.push_back(nullptr);
+    return layered.data();
+}
+
+// ---- builtins ----
+
+int builtin_cd(const vector<string> &argv) {
+    const string *home = sh->env.get("HOME");
+    const char *path = (argv.size() > 1) ? argv[1].c_str() : (home ? home->c_str() : nullptr);
+    if (!path) path = "/";
+    if (chdir(path) != 0) {
+        perror("cd");
+        return 1;
+    }
+    return 0;
+}
+
+int builtin_exit(const vector<string> &argv) {
+    exit(argv.size() > 1 ? atoi(argv[1].c_str()) : 0);
+}
+
+// export NAME[=value]...; no arguments lists exported variables
+int builtin_export(const vector<string> &argv) {
+    if (argv.size() == 1) sh->env.print_exported();
+    for (size_t k = 1; k < argv.size(); ++k) {
+        size_t len = assignment_name_len(argv[k]);
+        if (len) sh->env.set(argv[k].substr(0, len), argv[k].substr(len + 1), true);
+        else sh->env.export_var(argv[k]);
+    }
+    return 0;
+}
+
+// unset NAME..., unset -f FUNCTION...
+int builtin_unset(const vector<string> &argv) {
+    size_t k = 1;
+    bool funcs = k < argv.size() && argv[k] == "-f";
+    if (funcs || (k < argv.size() && argv[k] == "-v")) ++k;
+    for (; k < argv.size(); ++k) {
+        if (funcs) remove_function(argv[k]);
+        else sh->env.unset(argv[k]);
+    }
+    return 0;
+}
+
+// ---- shell options ----
+// set -o NAME turns an option on, set +o NAME off, set -o lists them.
+
+struct ShellOption {
+    const char *name;
+    bool ShellState::*flag;
+};
+
+const ShellOption shell_options[] = {
+    { "fadvise", &ShellState::opt_fadvise },
+    { "odirect", &ShellState::opt_odirect },
+    { "joblog", &ShellState::opt_joblog },
+    { "pipefail", &ShellState::opt_pipefail },
+};
+
+int builtin_set(const vector<string> &argv) {
+    if (argv.size() == 1 || (argv.size() == 2 && (argv[1] == "-o" || argv[1] == "+o"))) {
+        for (const auto &o : shell_options)
+            std_out << (sh->*o.flag ? "set -o " : "set +o ") << o.name << "\n";
+        return 0;
+    }
+    int status = 0;
+    for (size_t k = 1; k < argv.size(); ++k) {
+        if ((argv[k] != "-o" && argv[k] != "+o") || k + 1 >= argv.size()) {
+            std_err << "set: usage: set [-o|+o] [option]\n";
+            return 2;
+        }
+        bool on = argv[k] == "-o";
+        const string &name = argv[++k];
+        const ShellOption *opt = nullptr;
+        for (const auto &o : shell_options) if (name == o.name) opt = &o;
+        if (!opt) {
+            std_err << "set: " << name << ": invalid option name\n";
+            status = 1;
+            continue;
+        }
+        sh->*opt->flag = on;
+    }
+    return status;
+}
+
+// hash: show compiled-line cache stats, hash -r: forget everything
+int builtin_hash(const vector<string> &argv) {
+    if (argv.size() > 1 && argv[1] == "-r") sh->cmd_cache.clear();
+    else sh->cmd_cache.print_stats();
+    return 0;
+}
+
+// jobs [-l | --stats | --json]
+int builtin_jobs(const vector<string> &argv) {
+    if (argv.size() == 1) {
+        print_jobs();
+        return 0;
+    }
+    // exact figures (scripts have no prompt loop reaping); nothing but JSON in --json
+    update_jobs(argv[1] != "--json");
+    if (argv.size() == 2 && (argv[1] == "-l" || argv[1] == "--stats")) {
+        print_job_stats();
+    } else if (argv.size() == 2 && argv[1] == "--json") {
+        print_jobs_json();
+    } else {
+        std_err << "jobs: usage: jobs [-l | --stats | --json]\n";
+        return 2;
+    }
+    return 0;
+}
+
+int builtin_echo(const vector<string> &argv) {
+    size_t k = 1;
+    bool newline = true;
+    if (k < argv.size() && argv[k] == "-n") { newline = false; ++k; }
+    for (size_t first = k; k < argv.size(); ++k) {
+        if (k > first) std_out << ' ';
+        std_out << argv[k];
+    }
+    if (newline) std_out << '\n';
+    return 0;
+}
+
+int builtin_pwd(const vector<string> &) {
+    char buf[4096];
+    if (!getcwd(buf, sizeof(buf))) {
+        perror("pwd");
+        return 1;
+    }
+    std_out << buf << '\n';
+    return 0;
+}
+
+int builtin_true(const vector<string> &) { return 0; }
+int builtin_false(const vector<string> &) { return 1; }
+
+// read [-r] [NAME...]: one line of stdin, split on IFS; the last NAME gets
+// the rest of the line. Seekable input (files, heredoc memfds) is read a
+// block at a time and rewound to just past the newline; pipes a byte at a
+// time, so whatever follows the line is left for the next command.
+int builtin_read(const vector<string> &argv) {
+    size_t k = 1;
+    bool raw = k < argv.size() && argv[k] == "-r";
+    if (raw) ++k;
+    vector<string> names(argv.begin() + k, argv.end());
+    if (names.empty()) names.push_back("REPLY");
+
+    string line;
+    bool got_newline = false, any = false;
+    bool seekable = lseek(STDIN_FILENO, 0, SEEK_CUR) >= 0;
+    char buf[4096];
+    while (!got_newline) {
+        ssize_t r = read(STDIN_FILENO, buf, seekable ? sizeof(buf) : 1);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        any = true;
+        ssize_t used = 0;
+        while (used < r && !got_newline) {
+            char ch = buf[used++];
+            if (ch == '\n') {
+                if (!raw && !line.empty() && line.back() == '\\') line.pop_back();     // continuation
+                else got_newline = true;
+            } else {
+                line += ch;
+            }
+        }
+        if (seekable && used < r) lseek(STDIN_FILENO, used - r, SEEK_CUR);
+    }
+    if (!raw) {
+        string unescaped;
+        for (size_t i = 0; i < line.size(); ++i) {
+            if (line[i] == '\\' && i + 1 < line.size()) ++i;
+            unescaped += line[i];
+        }
+        line.swap(unescaped);
+    }
+
+    const string *ifs_var = sh->env.get("IFS");
+    const char *ifs = ifs_var ? ifs_var->c_str() : " \t\n";
+    size_t i = 0;
+    for (size_t v = 0; v < names.size(); ++v) {
+        while (i < line.size() && strchr(ifs, line[i])) ++i;
+        size_t start = i;
+        if (v + 1 == names.size()) {
+            i = line.size();
+            while (i > start && strchr(ifs, line[i - 1])) --i;
+        } else {
+            while (i < line.size() && !strchr(ifs, line[i])) ++i;
+        }
+        sh->env.set(names[v], line.substr(start, i - start));
+    }
+    return any ? 0 : 1;
+}
+
+// a job named as %n (job id), n (job id, else pid) or a pid/pgid
+Job *find_job_arg(const string &arg) {
+    if (!arg.empty() && arg[0] == '%') {
+        int jid = atoi(arg.c_str() + 1);
+        return jid > 0 ? find_job_by_jid(jid) : nullptr;
+    }
+    // if token is all digits try as job id first
+    bool all_digits = !arg.empty();
+    for (char c : arg) {
+        if (c < '0' || c > '9') { all_digits = false; break; }
+    }
+    Job *target = nullptr;
+    if (all_digits) target = find_job_by_jid(atoi(arg.c_str()));
+    if (!target) {
+        pid_t p = (pid_t)atoi(arg.c_str());
+        if (p != 0) target = find_job_by_pgid(p) ? find_job_by_pgid(p) : find_job_by_pid(p);
+    }
+    return target;
+}
+
+// Block until a child may have changed state (SIGCHLD), signalling jobs
+// whose deadline comes first and, with log, following a captured job's
+// output meanwhile. True if SIGCHLD notifications were consumed, which
+// other jobs may need: the caller runs update_jobs for them afterwards.
+bool wait_child_event(JobLog *log) {
+    struct pollfd pfd[3] = {{sh->sigchld_fd, POLLIN, 0}, {sh->deadlines.fd(), POLLIN, 0},
+                            {log && log->pipe_fd >= 0 ? log->pipe_fd : -1, POLLIN, 0}};
+    bool got = false;
+    if (poll(pfd, 3, -1) > 0) {
+        if (pfd[0].revents) got = drain_sigchld_fd();
+        if (pfd[1].revents) run_deadlines();
+        if (pfd[2].revents) drain_job_log(*log, STDOUT_FILENO);
+    }
+    return got;
+}
+
+// fg/bg [%n | n | pid]: default is the most recent job
+int builtin_fg_bg(const vector<string> &tokens) {
+    // determine target job
+    Job *target = nullptr;
+    if (tokens.size() > 1) {
+        target = find_job_arg(tokens[1]);
+    } else {
+        if (!sh->jobs.empty()) target = &sh->jobs.back();
+    }
+
+    if (!target) {
+        std_err << tokens[0] << ": no such job\n";
+        return 1;
+    }
+
+    if (tokens[0] == "bg") {
+        // continue in background
+        if (kill(-target->pgid, SIGCONT) < 0) perror("kill(SIGCONT)");
+        target->status = RUNNING;
+        std_out << "[" << target->jid << "] " << target->pgid << " Continued in background\n";
+        return 0;
+    }
+
+    // fg: put job in foreground
+    // give terminal to job pgid
+    if (sh->job_control && tcsetpgrp(STDIN_FILENO, target->pgid) < 0) {
+        // ignore
+    }
+    // send SIGCONT to the job's process group
+    if (kill(-target->pgid, SIGCONT) < 0) perror("kill(SIGCONT)");
+    target->status = RUNNING;
+    // wait for it; a captured job's output is shown (and still logged)
+    // meanwhile, so it never blocks on a full pipe
+    JobLog *log = find_job_log(target->jid);
+    bool missed_sigchld = false;
+    int status = 0, last_status = 0;
+    pid_t w;
+    struct rusage ru;
+    while (true) {
+        bool follow = ((log && log->pipe_fd >= 0) || sh->deadlines.pending()) && sh->sigchld_fd >= 0;
+        w = wait4(-target->pgid, &status, WUNTRACED | (follow ? WNOHANG : 0), &ru);
+        if (w == 0) {
+            missed_sigchld |= wait_child_event(log);
+            continue;
+        }
+        if (w < 0) {
+            if (errno == ECHILD) break;
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (WIFSTOPPED(status)) {
+            target->status = STOPPED;
+            if (sh->interactive)
+                std_out << "\n[" << target->jid << "] " << target->pgid << " Stopped    " << target->cmd << "\n";
+            last_status = 128 + SIGTSTP;
+            break;
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            // continue until all processes in group handled
+            job_reap_pid(*target, w, status, ru);
+            last_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        }
+    }
+    // if job finished, remove it
+    // check if any processes remain in pgid by attempting to send 0 signal
+    if (kill(-target->pgid, 0) < 0) {
+        // likely no such process group -> remove job
+        if (target->pids.empty()) {
+            last_status = target->exit_status;
+            sh->pipe_status = target->stage_status;
+        }
+        if (sh->deadlines.finish(target->pgid)) last_status = 124;
+        remove_job_by_pgid(target->pgid);
+    } else {
+        // if stopped we kept it in jobs (status set above)
+    }
+    if (log) drain_job_log(*log, STDOUT_FILENO);
+    // restore terminal to shell
+    if (sh->job_control) tcsetpgrp(STDIN_FILENO, sh->shell_pgid);
+    if (sh->interactive) tcsetattr(STDIN_FILENO, TCSADRAIN, &sh->shell_tmodes);
+    // other jobs that changed state while we were waiting
+    if (missed_sigchld) update_jobs();
+    return last_status;
+}
+
+// ---- wait ----
+// Blocks in one epoll_wait on a pidfd per unreaped process of the awaited
+// jobs (plus the pipes of captured jobs, so they cannot stall on a full
+// pipe). Every wake-up goes through update_jobs, which reaps the children,
+// records exit statuses and moves finished jobs to done_jobs. Without
+// pidfd_open (kernels before 5.3) the SIGCHLD signalfd wakes it instead.
+
+static int pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// a finished job named like find_job_arg does
+static Job *find_done_job(const string &arg) {
+    bool percent = !arg.empty() && arg[0] == '%';
+    int n = atoi(arg.c_str() + (percent ? 1 : 0));
+    if (n <= 0) return nullptr;
+    for (auto &j : sh->done_jobs)
+        if (j.jid == n || (!percent && (j.pgid == n || j.last_pid == n))) return &j;
+    return nullptr;
+}
+
+// status of a finished job, which wait then forgets
+static int collect_done_job(pid_t pgid) {
+    for (auto it = sh->done_jobs.begin(); it != sh->done_jobs.end(); ++it) {
+        if (it->pgid != pgid) continue;
+        int status = it->exit_status;
+        sh->done_jobs.erase(it);
+        return status;
+    }
+    return 127;
+}
+
+// Wait until every job in pgids has finished (any: the first one). status
+// is that of the last one collected. Returns false when timeout_ms (>= 0)
+// expired first.
+static bool wait_for_jobs(vector<pid_t> pgids, bool any, int64_t timeout_ms, int &status) {
+    int64_t deadline = timeout_ms >= 0 ? monotonic_ms() + timeout_ms : -1;
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (ep < 0) {
+        perror("epoll_create1");
+        return true;
+    }
+    vector<pair<pid_t, int>> pidfds;
+    bool sigchld_added = false, done = false, expired = false;
+    if (sh->deadlines.fd() >= 0) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        epoll_ctl(ep, EPOLL_CTL_ADD, sh->deadlines.fd(), &ev);
+    }
+    while (!done) {
+        if (sh->deadlines.pending()) run_deadlines();
+        update_jobs();
+        drain_job_logs();
+
+        // collect what finished, keep watching the rest
+        for (size_t k = 0; k < pgids.size(); ++k) {
+            if (find_job_by_pgid(pgids[k])) continue;
+            status = collect_done_job(pgids[k]);
+            pgids.erase(pgids.begin() + k--);
+            if (any) done = true;
+        }
+        if (pgids.empty()) done = true;
+        if (done || expired) break;
+        vector<pid_t> live;
+        for (pid_t pg : pgids)
+            for (pid_t pid : find_job_by_pgid(pg)->pids) live.push_back(pid);
+
+        // pidfds: drop reaped processes, add new ones
+        bool ready = false;
+        for (size_t k = 0; k < pidfds.size(); ++k) {
+            if (find(live.begin(), live.end(), pidfds[k].first) != live.end()) continue;
+            close(pidfds[k].second);    // also leaves the epoll set
+            pidfds.erase(pidfds.begin() + k--);
+        }
+        for (pid_t pid : live) {
+            bool have = false;
+            for (const auto &p : pidfds) have |= p.first == pid;
+            if (have) continue;
+            int fd = pidfd_open(pid);
+            if (fd >= 0) {
+                struct epoll_event ev = {};
+                ev.events = EPOLLIN;
+                epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+                pidfds.push_back({pid, fd});
+            } else if (errno == ESRCH) {
+                ready = true;           // already gone: reap on the next pass
+            } else if (!sigchld_added) {
+                if (!sh->watching_children) watch_children();
+                struct epoll_event ev = {};
+                ev.events = EPOLLIN;
+                sigchld_added = sh->sigchld_fd >= 0 && epoll_ctl(ep, EPOLL_CTL_ADD, sh->sigchld_fd, &ev) == 0;
+            }
+        }
+        for (const auto &l : sh->job_logs) {
+            if (l.pipe_fd < 0) continue;
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN;
+            epoll_ctl(ep, EPOLL_CTL_ADD, l.pipe_fd, &ev);   // EEXIST when already there
+        }
+
+        int wait_ms = -1;
+        if (ready) {
+            wait_ms = 0;
+        } else if (deadline >= 0) {
+            wait_ms = (int)max<int64_t>(deadline - monotonic_ms(), 0);
+        }
+        struct epoll_event events[16];
+        int n = epoll_wait(ep, events, 16, wait_ms);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        if (sigchld_added) drain_sigchld_fd();
+        // one more pass to collect what finished right at the deadline
+        if (n == 0 && !ready) expired = true;
+    }
+    for (const auto &p : pidfds) close(p.second);
+    close(ep);
+    return done || !expired;
+}
+
+// wait [-n] [--timeout SECS] [%n | n | pid ...]
+// Without operands: every running job, status 0. Otherwise the status of
+// the last operand (-n: of the first job to finish), 127 for an unknown
+// job, 124 if the timeout expires first.
+int builtin_wait(const vector<string> &argv) {
+    bool any = false;
+    int64_t timeout_ms = -1;
+    size_t k = 1;
+    for (; k < argv.size() && argv[k].size() > 1 && argv[k][0] == '-'; ++k) {
+        if (argv[k] == "-n") {
+            any = true;
+        } else if (argv[k] == "--timeout" && k + 1 < argv.size()) {
+            timeout_ms = (int64_t)(atof(argv[++k].c_str()) * 1000);
+        } else if (argv[k] == "--") {
+            ++k;
+            break;
+        } else {
+            std_err << "wait: usage: wait [-n] [--timeout SECS] [%n | pid ...]\n";
+            return 2;
+        }
+    }
+
+    int status = 0;
+    vector<pid_t> pgids;
+    bool every_job = k == argv.size();
+    if (every_job) {
+        // -n also counts jobs that finished before it was called
+        if (any && !sh->done_jobs.empty()) return collect_done_job(sh->done_jobs.front().pgid);
+        for (const auto &j : sh->jobs)
+            if (j.status == RUNNING) pgids.push_back(j.pgid);
+        if (!any) sh->done_jobs.clear();
+        if (pgids.empty()) return any ? 127 : 0;
+    }
+    for (; k < argv.size(); ++k) {
+        Job *j = find_job_arg(argv[k]);
+        if (!j) j = find_done_job(argv[k]);
+        if (j) {
+            pgids.push_back(j->pgid);
+        } else {
+            std_err << "wait: " << argv[k] << ": no such job\n";
+            status = 127;
+        }
+    }
+    if (pgids.empty()) return status;
+    if (!wait_for_jobs(pgids, any, timeout_ms, status)) return 124;
+    return every_job && !any ? 0 : status;
+}
+
+int builtin_break(const vector<string> &argv);
+int builtin_local(const vector<string> &argv);
+int builtin_return(const vector<string> &argv);
+
+typedef int (*BuiltinFn)(const vector<string> &argv);
+
+struct Builtin {
+    const char *name;
+    BuiltinFn fn;
+    bool in_child;      // touches no shell state: may run as a forked pipeline stage
+};
+
+const Builtin builtins[] = {
+    { "cd",       builtin_cd,     false },
+    { "exit",     builtin_exit,   false },
+    { "export",   builtin_export, false },
+    { "unset",    builtin_unset,  false },
+    { "hash",     builtin_hash,   false },
+    { "set",      builtin_set,    false },
+    { "fg",       builtin_fg_bg,  false },
+    { "bg",       builtin_fg_bg,  false },
+    { "wait",     builtin_wait,   false },
+    { "break",    builtin_break,  false },
+    { "continue", builtin_break,  false },
+    { "read",     builtin_read,   false },
+    { "local",    builtin_local,  false },
+    { "return",   builtin_return, false },
+    { "jobs",     builtin_jobs,   true },
+    { "joblog",   builtin_joblog, true },
+    { "echo",     builtin_echo,   true },
+    { "pwd",      builtin_pwd,    true },
+    { "true",     builtin_true,   true },
+    { ":",        builtin_true,   true },
+    { "false",    builtin_false,  true },
+};
+
+const Builtin* find_builtin(const string &name) {
+    for (const auto &b : builtins)
+        if (name == b.name) return &b;
+    return nullptr;
+}
+
+// Builtins that only produce output. They run inside the shell when the
+// command stands alone, and inside the forked child when piped/redirected.
+bool run_output_builtin(const vector<string> &argv, int &status) {
+    const Builtin *b = find_builtin(argv[0]);
+    if (!b || !b->in_child) return false;
+    status = b->fn(argv);
+    std_out.flush();
+    return true;
+}
+
+// child side of a fork: join the job's process group, restore default signals
+// (own_group: a group of its own even without job control, for a timed job)
+void child_setup(pid_t pgid, bool own_group = false) {
+    // create/join process group
+    if (sh->job_control || own_group) {
+        if (pgid == 0) setpgid(0, 0);
+        else setpgid(0, pgid);
+    }
+
+    // set default signal handlers for child
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    sigprocmask(SIG_UNBLOCK, &sigchld_mask, nullptr);
+}
+
+// ---- redirections ----
+// A command's redirections are not replayed one by one. The files are opened
+// in order (O_CLOEXEC), the final fd table is worked out, and only the moves
+// needed to reach it are made: a parallel move of dup2 calls that needs a
+// temporary only for cycles such as 3>&1 1>&2 2>&3, then the closes. Opened
+// files that are not moved into place are left to close-on-exec.
+// Heredoc fds are made at this point too, i.e. in the child, so the shell
+// never blocks on a large body.
+
+// A readable fd holding data, for <<EOF and <<<. A body that fits in the
+// pipe buffer goes into a pipe (the write cannot block); a larger one into a
+// sealed memfd, which the reader gets as an ordinary seekable file. Nothing
+// is written to disk and no writer process is needed.
+int here_fd(string_view data) {
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) == 0) {
+        long cap = fcntl(p[1], F_GETPIPE_SZ);
+        if (cap > 0 && data.size() <= (size_t)cap) {
+            ssize_t w = data.empty() ? 0 : write(p[1], data.data(), data.size());
+            close(p[1]);
+            if (w == (ssize_t)data.size()) return p[0];
+            close(p[0]);
+            return -1;
+        }
+        close(p[0]);
+        close(p[1]);
+    }
+    int fd = memfd_create("heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) return -1;
+    for (size_t off = 0; off < data.size();) {
+        ssize_t w = write(fd, data.data() + off, data.size() - off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        off += w;
+    }
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+struct FdPlan {
+    vector<pair<int, int>> moves;   // target fd <- source fd
+    vector<int> closes;
+    vector<int> opened;             // fds opened for the plan
+};
+
+// "64M" -> bytes (K, M, G, T suffixes are powers of 1024); 0 if malformed
+uint64_t parse_size(const string &text) {
+    char *end = nullptr;
+    unsigned long long n = strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str()) return 0;
+    switch (toupper((unsigned char)*end)) {
+    case 'T': n <<= 10; // fall through
+    case 'G': n <<= 10; // fall through
+    case 'M': n <<= 10; // fall through
+    case 'K': n <<= 10; ++end; break;
+    }
+    return *end ? 0 : n;
+}
+
+// Output files of large jobs: reserve PREALLOC bytes past the current end
+// up front (KEEP_SIZE, so a short write leaves no padding) to avoid
+// fragmentation, and with "set -o fadvise" tell the kernel the file is
+// written once, sequentially. Failures are ignored: these are only hints.
+static void tune_output(int fd, bool append) {
+    if (const string *size = sh->env.get("PREALLOC")) {
+        uint64_t len = parse_size(*size);
+        off_t from = append ? lseek(fd, 0, SEEK_END) : 0;
+        if (len && from >= 0) fallocate(fd, FALLOC_FL_KEEP_SIZE, from, len);
+    }
+    if (sh->opt_fadvise) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+    }
+}
+
+// open the files and compute the moves; false (after a message) on error.
+// direct: the fds go to an exec'd program, so "set -o odirect" may apply
+// (the shell's own buffered writes could not meet O_DIRECT alignment)
+bool plan_redirects(const vector<Redirect> &redirs, FdPlan &plan, bool direct = true) {
+    vector<pair<int, int>> table;   // fd -> where it now points (-1: closed)
+    auto current = [&](int fd) {
+        for (const auto &t : table) if (t.first == fd) return t.second;
+        return fd;
+    };
+    auto assign = [&](int fd, int src) {
+        for (auto &t : table) if (t.first == fd) { t.second = src; return; }
+        table.emplace_back(fd, src);
+    };
+    for (const auto &r : redirs) {
+        int src;
+        switch (r.op) {
+        case R_DUP:
+            src = current(atoi(r.target.c_str()));
+            if (src < 0 || r.target.find_first_not_of("0123456789") != string::npos ||
+                fcntl(src, F_GETFD) < 0) {
+                std_err << r.target << ": bad file descriptor\n";
+                return false;
+            }
+            break;
+        case R_CLOSE:
+            src = -1;
+            break;
+        case R_HERE:
+            src = here_fd(r.target);
+            if (src < 0) { perror("heredoc"); return false; }
+            plan.opened.push_back(src);
+            break;
+        default: {
+            static const int flags[] = { O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC,
+                                         O_WRONLY | O_CREAT | O_APPEND, O_RDWR | O_CREAT };
+            bool output = r.op == R_WRITE || r.op == R_APPEND;
+            int extra = (output && direct && sh->opt_odirect) ? O_DIRECT : 0;
+            src = open(r.target.c_str(), flags[r.op] | extra | O_CLOEXEC, 0644);
+            if (src < 0 && extra && errno == EINVAL)        // filesystem without O_DIRECT
+                src = open(r.target.c_str(), flags[r.op] | O_CLOEXEC, 0644);
+            if (src < 0) { perror(r.target.c_str()); return false; }
+            plan.opened.push_back(src);
+            if (output) tune_output(src, r.op == R_APPEND);
+            else if (sh->opt_fadvise) posix_fadvise(src, 0, 0, POSIX_FADV_SEQUENTIAL);
+            break;
+        }
+        }
+        assign(r.fd, src);
+    }
+    for (const auto &t : table) {
+        if (t.second < 0) plan.closes.push_back(t.first);
+        else if (t.second != t.first) plan.moves.push_back(t);
+        else fcntl(t.first, F_SETFD, 0);    // opened right onto its target: keep it across exec
+    }
+    return true;
+}
+
+bool run_plan(FdPlan &plan) {
+    vector<pair<int, int>> &moves = plan.moves;
+    while (!moves.empty()) {
+        // a move whose target no other pending move still reads from
+        size_t k = 0;
+        for (; k < moves.size(); ++k) {
+            bool read_later = false;
+            for (size_t j = 0; j < moves.size(); ++j)
+                if (j != k && moves[j].second == moves[k].first) read_later = true;
+            if (!read_later) break;
+        }
+        if (k == moves.size()) {
+            // only cycles left: park one target elsewhere and retry
+            int tmp = fcntl(moves[0].first, F_DUPFD_CLOEXEC, 10);
+            if (tmp < 0) { perror("fcntl"); return false; }
+            for (auto &m : moves) if (m.second == moves[0].first) m.second = tmp;
+            continue;
+        }
+        if (dup2(moves[k].second, moves[k].first) < 0) { perror("dup2"); return false; }
+        moves.erase(moves.begin() + k);
+    }
+    for (int fd : plan.closes) close(fd);
+    return true;
+}
+
+struct SavedFd {
+    int fd;
+    int copy;           // -1: fd was not open
+    bool cloexec;
+};
+
+// Apply redirections inside the shell itself (a function call, a redirected
+// compound command): every fd they touch is first saved in saved so that
+// restore_fds can put it back afterwards.
+bool redirect_in_shell(const vector<Redirect> &redirs, vector<SavedFd> &saved) {
+    std_out.flush();
+    for (const auto &r : redirs) {
+        bool seen = false;
+        for (const auto &s : saved) if (s.fd == r.fd) seen = true;
+        if (!seen) saved.push_back(SavedFd{r.fd, fcntl(r.fd, F_DUPFD_CLOEXEC, 10),
+                                           (fcntl(r.fd, F_GETFD) & FD_CLOEXEC) != 0});
+    }
+    FdPlan plan;
+    bool ok = plan_redirects(redirs, plan, false) && run_plan(plan);
+    for (int fd : plan.opened) {
+        bool in_place = false;
+        for (const auto &r : redirs) if (r.fd == fd) in_place = true;
+        if (!in_place) close(fd);
+    }
+    return ok;
+}
+
+void restore_fds(vector<SavedFd> &saved) {
+    std_out.flush();
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+        if (it->copy < 0) {
+            close(it->fd);          // was not open before
+            continue;
+        }
+        dup3(it->copy, it->fd, it->cloexec ? O_CLOEXEC : 0);
+        close(it->copy);
+    }
+    saved.clear();
+}
+
+// In the child, after stdin/stdout are wired to the pipeline: apply the
+// command's own redirections and exec it (or run a forkable builtin).
+[[noreturn]] void exec_command(Command &cmd) {
+    FdPlan plan;
+    if (!plan_redirects(cmd.redirs, plan) || !run_plan(plan)) _exit(1);
+
+    // prepare argv
+    if (cmd.argv.empty()) _exit(0);
+    vector<char*> argv;
+    for (auto &s : cmd.argv) argv.push_back(const_cast<char*>(s.c_str()));
+    argv.push_back(nullptr);
+
+    // any builtin runs in this child as is; shell state it changes stays here
+    if (const Builtin *b = find_builtin(cmd.argv[0])) {
+        close_coproc_fds();
+        int status = b->fn(cmd.argv);
+        std_out.flush();
+        _exit(status);
+    }
+
+    // a function stage runs in this child as it is, with no exec
+    if (is_shell_function(cmd.argv[0])) {
+        leave_parent_shell();
+        int status = call_function(cmd.argv, cmd.assigns);
+        std_out.flush();
+        _exit(status);
+    }
+
+    // environment: shared envp, with VAR=val prefixes layered on top
+    environ = sh->env.envp();
+    if (!cmd.assigns.empty()) environ = layer_env(environ, cmd.assigns);
+
+    if (!cmd.exec_path.empty()) {
+        execve(cmd.exec_path.c_str(), argv.data(), environ);
+        // binary moved since the line was cached - fall back to a PATH search
+    }
+    execvp(argv[0], argv.data());
+    perror("exec");
+    _exit(EXIT_FAILURE);
+}
+
+// Parent side once every process of a job is forked: register a background
+// job, or hand the terminal to the job and wait until it exits or stops.
+// Returns the status of the last process in pids. helpers (the processes of
+// <(cmd) / >(cmd)) belong to the job too, but are not stages of it.
+int finish_job(const vector<pid_t> &pids, pid_t pgid, bool background, const string &raw_cmdline, bool logged = false,
+               const vector<pid_t> &helpers = {}) {
+    // foreground handling: give terminal to job's pgid, wait for it to finish/stop
+    if (pgid == 0) pgid = pids.empty() ? 0 : pids[0];
+    int last_status = 0;
+    Job job = new_job(pgid, pids, raw_cmdline, RUNNING);
+    job.pids.insert(job.pids.end(), helpers.begin(), helpers.end());
+
+    if (background) {
+        // add to job list
+        Job &j = add_job(std::move(job));
+        if (logged) sh->job_logs.back().jid = j.jid;
+        if (sh->interactive) std_out << "[" << j.jid << "] " << j.pgid << " Started\n";
+    } else {
+        // put job in foreground
+        // give terminal control to job
+        if (sh->job_control && tcsetpgrp(STDIN_FILENO, pgid) < 0) {
+            // may fail; continue anyway
+        }
+
+        // wait for job: wait on process group (without job control the
+        // processes share our group, so wait for them one by one)
+        // with deadlines pending, sleep on SIGCHLD and the timer instead
+        int status;
+        pid_t wpid;
+        struct rusage ru;
+        bool job_stopped = false, missed_sigchld = false;
+        while (!job.pids.empty()) {
+            bool timed = sh->deadlines.pending() && sh->sigchld_fd >= 0;
+            wpid = wait4(sh->job_control ? -pgid : job.pids.front(), &status, WUNTRACED | (timed ? WNOHANG : 0), &ru);
+            if (wpid == 0) {
+                missed_sigchld |= wait_child_event(nullptr);
+                continue;
+            }
+            if (wpid < 0) {
+                if (errno == ECHILD) break;
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (WIFSTOPPED(status)) {
+                job_stopped = true;
+                // add to job list as stopped, with what it has used so far
+                job.status = STOPPED;
+                Job &j = add_job(std::move(job));
+                if (sh->interactive)
+                    std_out << "\n[" << j.jid << "] " << j.pgid << " Stopped    " << j.cmd << "\n";
+                break;
+            }
+            // continue waiting until all in group are reaped
+            if (WIFEXITED(status) || WIFSIGNALED(status)) job_reap_pid(job, wpid, status, ru);
+        }
+        // the pipeline's status is that of its last stage (pipefail: last failing)
+        if (job_stopped) {
+            last_status = 128 + SIGTSTP;
+        } else {
+            last_status = job.exit_status;
+            sh->pipe_status.swap(job.stage_status);
+        }
+        if (!job_stopped && sh->deadlines.finish(pgid)) last_status = 124;
+
+        // restore terminal to shell
+        if (sh->job_control) tcsetpgrp(STDIN_FILENO, sh->shell_pgid);
+        // restore shell terminal modes in case the job changed them
+        if (sh->interactive) tcsetattr(STDIN_FILENO, TCSADRAIN, &sh->shell_tmodes);
+        // background jobs that changed state while we were waiting
+        if (missed_sigchld) update_jobs();
+    }
+
+    return last_status;
+}
+
+// parent: put a freshly forked child into the job's group
+static void join_job_group(pid_t pid, pid_t &pgid, bool own_group = false) {
+    // establish pgid (set group of child to pgid)
+    if (pgid == 0) pgid = pid;
+    if (sh->job_control || own_group) setpgid(pid, pgid);   // may fail if the child already did it
+}
+
+// ---- in-process file copy ----
+// "cat a b > c" and "cat < a > c" only move bytes between files, so the shell
+// does the copy itself with copy_file_range (a reflink or in-kernel copy on
+// filesystems that support it) instead of forking cat and pushing every byte
+// through user space. If the filesystems refuse, it falls back to sendfile,
+// then to splice through a pipe, then to plain read/write. Only a command
+// typed as plain "cat" with no options qualifies, and only regular files;
+// anything else (and /bin/cat spelled out) runs the real program.
+
+volatile sig_atomic_t copy_interrupted = 0;
+
+static void on_copy_sigint(int) { copy_interrupted = 1; }
+
+// copy everything from in to out; -1 with errno set on failure
+static int copy_fd(int in, int out) {
+    const size_t chunk = 64 << 20;      // lets Ctrl-C in between calls
+    enum { CFR, SENDFILE, SPLICE, RW } mode = CFR;
+    int pipefd[2] = { -1, -1 };
+    vector<char> buf;
+    int result = 0;
+    while (!copy_interrupted) {
+        ssize_t n = -1;
+        if (mode == CFR) {
+            n = copy_file_range(in, nullptr, out, nullptr, chunk, 0);
+            if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                mode = SENDFILE;
+                continue;
+            }
+        } else if (mode == SENDFILE) {
+            n = sendfile(out, in, nullptr, chunk);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                mode = SPLICE;
+                continue;
+            }
+        } else if (mode == SPLICE) {
+            if (pipefd[0] < 0 && pipe2(pipefd, O_CLOEXEC) < 0) {
+                mode = RW;
+                continue;
+            }
+            n = splice(in, nullptr, pipefd[1], nullptr, chunk, SPLICE_F_MOVE);
+            if (n < 0 && errno == EINVAL) {
+                mode = RW;
+                continue;
+            }
+            for (ssize_t left = n; left > 0;) {
+                ssize_t w = splice(pipefd[0], nullptr, out, nullptr, left, SPLICE_F_MOVE);
+                if (w < 0 && errno == EINTR) continue;
+                if (w <= 0) { n = -1; break; }
+                left -= w;
+            }
+        } else {
+            if (buf.empty()) buf.resize(1 << 20);
+            n = read(in, buf.data(), buf.size());
+            for (ssize_t off = 0; off < n;) {
+                ssize_t w = write(out, buf.data() + off, n - off);
+                if (w < 0 && errno == EINTR) continue;
+                if (w < 0) { n = -1; break; }
+                off += w;
+            }
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            result = n < 0 ? -1 : 0;
+            break;
+        }
+    }
+    int saved_errno = errno;
+    if (pipefd[0] >= 0) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+    errno = saved_errno;
+    return result;
+}
+
+// Run cmd in the shell if it is a plain file-to-file cat; false if it is not
+bool cat_copy(const Command &cmd, int &status) {
+    if (cmd.argv.empty() || cmd.argv[0] != "cat" || !cmd.assigns.empty()) return false;
+    vector<string> inputs(cmd.argv.begin() + 1, cmd.argv.end());
+    const Redirect *out = nullptr;
+    for (const auto &r : cmd.redirs) {
+        if (r.fd == STDIN_FILENO && r.op == R_READ && cmd.argv.size() == 1) inputs.assign(1, r.target);
+        else if (r.fd == STDOUT_FILENO && (r.op == R_WRITE || r.op == R_APPEND)) out = &r;
+        else return false;
+    }
+    if (!out || inputs.empty()) return false;
+    struct stat st;
+    for (const auto &in : inputs)
+        if (in.empty() || in[0] == '-' || stat(in.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) return false;
+    if (stat(out->target.c_str(), &st) == 0 && !S_ISREG(st.st_mode)) return false;
+
+    // single writer: seeking to the end is the same as O_APPEND, which
+    // copy_file_range and splice refuse
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (out->op == R_APPEND ? 0 : O_TRUNC);
+    int ofd = open(out->target.c_str(), flags, 0644);
+    if (ofd < 0) {
+        perror(out->target.c_str());
+        status = 1;
+        return true;
+    }
+    if (out->op == R_APPEND) lseek(ofd, 0, SEEK_END);
+    tune_output(ofd, out->op == R_APPEND);
+    struct stat ost;
+    fstat(ofd, &ost);
+
+    // ignored SIGINT would make a long copy impossible to stop
+    struct sigaction sa = {}, old;
+    sa.sa_handler = on_copy_sigint;
+    sigaction(SIGINT, &sa, &old);
+    copy_interrupted = 0;
+    status = 0;
+    for (const auto &in : inputs) {
+        int ifd = open(in.c_str(), O_RDONLY | O_CLOEXEC);
+        if (ifd < 0) {
+            std_err << "cat: " << in << ": " << strerror(errno) << "\n";
+            status = 1;
+            continue;
+        }
+        fstat(ifd, &st);
+        if (st.st_dev == ost.st_dev && st.st_ino == ost.st_ino && st.st_size > 0) {
+            std_err << "cat: " << in << ": input file is output file\n";
+            status = 1;
+        } else if (copy_fd(ifd, ofd) < 0) {
+            std_err << "cat: " << in << ": " << strerror(errno) << "\n";
+            status = 1;
+        }
+        close(ifd);
+        if (copy_interrupted) break;
+    }
+    sigaction(SIGINT, &old, nullptr);
+    close(ofd);
+    if (copy_interrupted) status = 128 + SIGINT;
+    return true;
+}
+
+// ---- process substitution ----
+// <(cmd) and >(cmd) turn into /dev/fd/N, the end of a pipe that the stage
+// naming it inherits at N; cmd, in a forked copy of the shell, has the other
+// end as its stdout (or stdin). So "diff <(sort a) <(sort b)" streams both
+// sorts into diff while they run, with no temp files written and read back.
+// The pipes are made on every run, on the copy of the commands that globs
+// are expanded on. The cmds are forked first: they lead the job's process
+// group and are counted among its processes, so fg, Ctrl-C, timeout and
+// jobs -l treat the line as one job; they are not stages, so PIPESTATUS and
+// pipefail do not see them.
+
+struct SubstPipe {
+    string text;        // cmd
+    bool output;        // >(cmd)
+    size_t stage;       // the pipeline stage whose word names it
+    int fd;             // that stage's end: /dev/fd/fd
+    int far_fd;         // cmd's stdin or stdout, until cmd is forked
+};
+
+void close_substs(vector<SubstPipe> &subs) {
+    for (auto &s : subs) {
+        close(s.fd);
+        if (s.far_fd >= 0) close(s.far_fd);
+    }
+    subs.clear();
+}
+
+// give every substitution in cmds its pipe and splice /dev/fd/N into its word
+bool open_substs(vector<Command> &cmds, vector<SubstPipe> &subs) {
+    for (size_t k = 0; k < cmds.size(); ++k) {
+        Command &c = cmds[k];
+        // back to front, so two in one word keep their offsets
+        for (auto p = c.substs.rbegin(); p != c.substs.rend(); ++p) {
+            int fds[2];
+            if (pipe2(fds, O_CLOEXEC) < 0) {
+                perror("pipe");
+                close_substs(subs);
+                return false;
+            }
+            int fd = high_fd(fds[p->output ? 1 : 0]);
+            subs.push_back(SubstPipe{p->text, p->output, k, fd, fds[p->output ? 0 : 1]});
+            string &word = p->redirect ? c.redirs[p->index].target : c.argv[p->index];
+            word.insert(p->offset, "/dev/fd/" + to_string(fd));
+        }
+        c.substs.clear();
+    }
+    return true;
+}
+
+// fork the cmd of every substitution into pgid's group (a new one if 0)
+vector<pid_t> start_substs(vector<SubstPipe> &subs, pid_t &pgid, bool own_group = false) {
+    vector<pid_t> pids;
+    std_out.flush();
+    for (auto &s : subs) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            child_setup(pgid, own_group);
+            dup2(s.far_fd, s.output ? STDIN_FILENO : STDOUT_FILENO);
+            // no exec here: the other pipe ends would stay open for good
+            for (const auto &o : subs) {
+                close(o.fd);
+                if (o.far_fd >= 0) close(o.far_fd);
+            }
+            leave_parent_shell();
+            int status = eval_source(s.text);
+            std_out.flush();
+            _exit(status);
+        }
+        close(s.far_fd);
+        s.far_fd = -1;
+        if (pid < 0) {
+            perror("fork");
+            continue;
+        }
+        join_job_group(pid, pgid, own_group);
+        pids.push_back(pid);
+    }
+    return pids;
+}
+
+// in a stage's child: keep its own ends open across exec, close the rest
+static void stage_substs(const vector<SubstPipe> &subs, size_t stage) {
+    for (const auto &s : subs) {
+        if (s.stage == stage) fcntl(s.fd, F_SETFD, 0);
+        else close(s.fd);
+    }
+}
+
+// after a command that ran inside the shell: closing its ends lets the
+// cmds see EOF (or SIGPIPE), then they are reaped
+void end_substs(vector<SubstPipe> &subs, const vector<pid_t> &pids) {
+    close_substs(subs);
+    for (pid_t pid : pids) {
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    }
+}
+
+// ---- pipeline stage fusion ----
+// In a foreground pipeline, the leading stages that need no process of their
+// own run in the shell, one after the other, before anything is forked:
+// echo, pwd, true, false and : written with no redirections or NAME=value
+// prefixes, and "cat FILE" on a regular file (not as the last stage). None
+// of them reads stdin, so only the last of them feeds the first forked stage.
+// A builtin's output is captured and given to that stage as stdin, as a
+// here-document body would be (a pipe or a sealed memfd, no writer process).
+// "cat FILE" gives it FILE itself, so "cat f | grep x | head" is grep reading
+// f with no cat in between; head exiting stops grep as before. Only a prefix
+// is fused: a stage behind a forked one must read (or close) its pipe while
+// the writer runs, or the writer would see SIGPIPE it would not get in a
+// real pipeline. Pipes are only made between two forked stages. The fused
+// stages' statuses come first in PIPESTATUS.
+
+static bool cat_file_stage(const Command &c) {
+    struct stat st;
+    return c.argv.size() == 2 && c.argv[0] == "cat" && !is_shell_function("cat") && !c.argv[1].empty() &&
+           c.argv[1][0] != '-' && stat(c.argv[1].c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static bool fusable_stage(const Command &c, bool last) {
+    if (c.argv.empty() || c.redirected() || !c.assigns.empty()) return false;
+    // builtins that only write output (jobs and joblog reap and drain: shell state)
+    for (const char *name : {"echo", "pwd", "true", "false", ":"})
+        if (c.argv[0] == name) return true;
+    return !last && cat_file_stage(c);
+}
+
+// run a fusable stage in the shell; next_in (null for the last stage) gets
+// what the next stage reads
+static int run_fused_stage(const Command &c, int *next_in) {
+    const Builtin *b = find_builtin(c.argv[0]);
+    if (!b) {       // cat FILE
+        int fd = open(c.argv[1].c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            *next_in = fd;
+            return 0;
+        }
+        std_err << "cat: " << c.argv[1] << ": " << strerror(errno) << "\n";
+        *next_in = here_fd("");
+        return 1;
+    }
+    if (!next_in) return b->fn(c.argv);
+    CaptureBuffer out;
+    std_out.capture(&out);
+    int status = b->fn(c.argv);
+    std_out.capture(nullptr);
+    *next_in = here_fd(out.view());
+    return status;
+}
+
+// timeout: a deadline for the job, which always forks (and gets its own group)
+// substs: the line's process substitutions, opened; closed here
+int runPipeline(vector<Command>& cmds, bool background, const string &raw_cmdline, const JobTimeout *timeout = nullptr,
+                vector<SubstPipe> *substs = nullptr) {
+    int n = cmds.size();
+    if (n == 0) return -1;
+    vector<SubstPipe> no_substs;
+    vector<SubstPipe> &subs = substs ? *substs : no_substs;
+
+    // Special-case single builtin executed in parent (only when not part of a pipeline)
+    if (n == 1 && !background && !timeout && subs.empty() && !cmds[0].argv.empty() && !cmds[0].redirected() &&
+        cmds[0].assigns.empty()) {
+        if (const Builtin *b = find_builtin(cmds[0].argv[0])) return single_status(b->fn(cmds[0].argv));
+    }
+
+    // cat FILE > FILE: copied by the kernel, no fork, no exec, no pipe
+    if (n == 1 && !background && !timeout && subs.empty()) {
+        int status;
+        if (cat_copy(cmds[0], status)) return single_status(status);
+    }
+
+    // the fused prefix runs now; pipes[2*i] is what stage i+1 reads,
+    // pipes[2*i+1] what stage i writes to
+    int fused = 0;
+    vector<int> status(n, 0);
+    vector<int> pipes(2 * (n - 1), -1);
+    if (n > 1 && !background && !timeout && subs.empty())
+        while (fused < n && fusable_stage(cmds[fused], fused == n - 1)) ++fused;
+    for (int i = 0; i < fused; ++i) {
+        status[i] = run_fused_stage(cmds[i], i < n - 1 ? &pipes[2*i] : nullptr);
+        // the output of all but the last one is dropped
+        if (i > 0) {
+            close(pipes[2*(i-1)]);
+            pipes[2*(i-1)] = -1;
+        }
+    }
+
+    // anything still buffered would be duplicated by the children
+    std_out.flush();
+
+    // substituted cmds first, so they hold none of the pipes below
+    pid_t pgid = 0;
+    vector<pid_t> helpers = start_substs(subs, pgid, timeout != nullptr);
+
+    // create pipes between forked stages
+    for (int i = fused; i < n - 1; ++i) {
+        if (pipe2(&pipes[2*i], O_CLOEXEC) < 0) {
+            perror("pipe");
+            pipes[2*i] = pipes[2*i + 1] = -1;
+            for (int fd : pipes) if (fd >= 0) close(fd);
+            end_substs(subs, helpers);
+            return -1;
+        }
+    }
+
+    // set -o joblog: the job writes into the shell instead of the terminal
+    int log_fd = background ? open_job_log(raw_cmdline) : -1;
+
+    vector<pid_t> pids;
+    for (int i = fused; i < n; ++i) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            // cleanup created children
+            for (pid_t c : pids) kill(-c, SIGTERM);
+            for (pid_t c : helpers) kill(c, SIGTERM);
+            for (int fd : pipes) if (fd >= 0) close(fd);
+            end_substs(subs, helpers);
+            if (log_fd >= 0) {
+                close(log_fd);
+                cancel_job_log();
+            }
+            return -1;
+        }
+        if (pid == 0) {
+            // child
+            child_setup(pgid, timeout != nullptr);
+
+            if (log_fd >= 0) {
+                dup2(log_fd, STDERR_FILENO);
+                if (i == n - 1) dup2(log_fd, STDOUT_FILENO);
+                close(log_fd);
+            }
+
+            // stdin from previous pipe if not first
+            if (i > 0 && pipes[2*(i-1)] >= 0) {
+                int in_fd = pipes[2*(i-1)];
+                if (dup2(in_fd, STDIN_FILENO) < 0) { perror("dup2"); _exit(1); }
+            }
+            // stdout to next pipe if not last
+            if (i < n-1) {
+                int out_fd = pipes[2*i + 1];
+                if (dup2(out_fd, STDOUT_FILENO) < 0) { perror("dup2"); _exit(1); }
+            }
+
+            // close all pipe fds in child
+            for (int fd : pipes) if (fd >= 0) close(fd);
+            stage_substs(subs, i);
+
+            exec_command(cmds[i]);
+        }
+        // parent
+        join_job_group(pid, pgid, timeout != nullptr);
+        pids.push_back(pid);
+    }
+
+    // parent: close all pipe fds
+    for (int fd : pipes) if (fd >= 0) close(fd);
+    close_substs(subs);
+    if (log_fd >= 0) close(log_fd);
+    if (timeout) arm_deadline(pgid, *timeout);
+
+    if (!fused) return finish_job(pids, pgid, background, raw_cmdline, log_fd >= 0, helpers);
+
+    int last_status = status[n - 1];
+    if (!pids.empty()) {
+        last_status = finish_job(pids, pgid, background, raw_cmdline, false, helpers);
+        if (find_job_by_pgid(pgid)) return last_status;     // stopped: it is a job now
+        // PIPESTATUS holds the forked stages' statuses
+        for (int i = fused, k = 0; i < n && k < (int)sh->pipe_status.size(); ++i) status[i] = sh->pipe_status[k++];
+    }
+    sh->pipe_status = status;
+    if (sh->opt_pipefail) {
+        last_status = 0;
+        for (int st : status) if (st > 0) last_status = st;
+    }
+    return last_status;
+}
+
+// ---- coprocesses ----
+// coproc [NAME] cmd... starts cmd as a background job whose stdin and stdout
+// are pipes to the shell, so one long-lived filter can serve many requests
+// instead of being started for each:
+//
+//   coproc CALC bc -l
+//   echo '2^10' >&${CALC[1]}; read r <&${CALC[0]}
+//
+// NAME (default COPROC) is set to "READ_FD WRITE_FD" and NAME_PID to the
+// pid. The first word is the NAME when more words follow and it is not a
+// command that can be found (builtin, function or on PATH). In the shell
+// the fds are close-on-exec: a command only gets them through an explicit
+// redirection. When the coprocess exits they are closed and the variables
+// unset.
+
+// strip "coproc [NAME]" from cmd
+void take_coproc(Command &cmd, string &name) {
+    vector<string> &argv = cmd.argv;
+    size_t k = 1;
+    name = "COPROC";
+    if (argv.size() > 2 && assignment_name_len(argv[1] + "=") == argv[1].size() &&
+        !is_builtin(argv[1]) && !is_shell_function(argv[1]) && resolve_path(argv[1]).empty()) {
+        name = argv[1];
+        k = 2;
+    }
+    argv.erase(argv.begin(), argv.begin() + k);
+    cmd.exec_path = resolve_path(argv[0]);
+}
+
+int start_coproc(const string &name, Command &cmd, const string &raw_cmdline) {
+    for (const auto &c : sh->coprocs) {
+        if (c.name == name) {
+            std_err << "coproc: " << name << ": already running\n";
+            return 1;
+        }
+    }
+    int in[2], out[2];      // the coprocess's stdin and stdout
+    if (pipe2(in, O_CLOEXEC) < 0) {
+        perror("pipe");
+        return 1;
+    }
+    if (pipe2(out, O_CLOEXEC) < 0) {
+        perror("pipe");
+        close(in[0]);
+        close(in[1]);
+        return 1;
+    }
+    std_out.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        child_setup(0);
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        // a builtin or function runs here without exec: drop every pipe end
+        // but the two it now has as stdin and stdout
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        exec_command(cmd);
+    }
+    close(in[0]);
+    close(out[1]);
+    if (pid < 0) {
+        perror("fork");
+        close(in[1]);
+        close(out[0]);
+        return 1;
+    }
+    pid_t pgid = 0;
+    join_job_group(pid, pgid);
+    Coproc c{name, pgid, high_fd(out[0]), high_fd(in[1])};
+    sh->coprocs.push_back(c);
+    sh->env.set(name, to_string(c.read_fd) + " " + to_string(c.write_fd));
+    sh->env.set(name + "_PID", to_string(pid));
+    return finish_job({pid}, pgid, true, raw_cmdline);
+}
+
+// the coprocess's job is gone
+void end_coproc(pid_t pgid) {
+    for (auto it = sh->coprocs.begin(); it != sh->coprocs.end(); ++it) {
+        if (it->pgid != pgid) continue;
+        close(it->read_fd);
+        close(it->write_fd);
+        sh->env.unset(it->name);
+        sh->env.unset(it->name + "_PID");
+        sh->coprocs.erase(it);
+        return;
+    }
+}
+
+// a builtin run inside the shell: NAME=value prefixes (IFS=, read a b) hold
+// only while it runs
+static int call_builtin(const Builtin *b, const Command &cmd) {
+    vector<SavedVar> saved;
+    for (const auto &a : cmd.assigns) {
+        size_t len = assignment_name_len(a);
+        string name = a.substr(0, len);
+        const Var *v = sh->env.find(name);
+        saved.push_back(SavedVar{name, v != nullptr, v ? *v : Var()});
+        sh->env.set(name, a.substr(len + 1));
+    }
+    int status = b->fn(cmd.argv);
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it)
+        sh->env.restore(it->name, it->was_set ? &it->var : nullptr);
+    return status;
+}
+
+int parse_job_token(const string &arg) {
+    // returns jid if %n form, otherwise 0
+    if (arg.empty()) return 0;
+    if (arg[0] == '%') {
+        return atoi(arg.c_str() + 1);
+    }
+    return 0;
+}
+
+// Run one input line: builtins, variable assignments, or a pipeline.
+// Returns the exit status of the line.
+int execute_line(string input) {
+    trim(input);
+    if (input.empty()) return 0;
+
+    // tokens and commands come from the compiled-line cache
+    CompiledLine scratch;
+    CompiledLine *compiled = compile_line(input, scratch);
+    // a background job is listed without its trailing &
+    if (compiled->background && input.back() == '&') {
+        input.pop_back();
+        trim(input);
+    }
+    return run_compiled(*compiled, false, input);
+}
+
+// Run an already compiled line (from the cache or a script's constant pool)
+int run_compiled(CompiledLine &compiled, bool background, const string &input) {
+    const vector<string> &tokens = compiled.tokens;
+    if (compiled.background) background = true;
+    if (compiled.failed) return single_status(1);
+    if (tokens.empty()) return 0;
+
+    // commands were built (handles |, <, >, >>) and resolved when the line was compiled
+    vector<Command> &cmds = compiled.cmds;
+    if (cmds.empty()) return 0;
+
+    // a line of only NAME=value words sets shell variables
+    if (cmds.size() == 1 && cmds[0].argv.empty() && !cmds[0].redirected()) {
+        for (const auto &a : cmds[0].assigns) {
+            size_t len = assignment_name_len(a);
+            sh->env.set(a.substr(0, len), a.substr(len + 1));
+        }
+        return single_status(0);
+    }
+
+    // globs depend on the filesystem, so they are expanded per run on a copy;
+    // <(cmd) / >(cmd) get their pipes there too, before argv indices move
+    vector<Command> expanded;
+    vector<SubstPipe> substs;
+    if (needs_glob(cmds) || needs_substs(cmds)) {
+        expanded = cmds;
+        if (!open_substs(expanded, substs)) return single_status(1);
+        expandGlobs(expanded);
+    }
+    // so is a timeout prefix stripped
+    JobTimeout timeout;
+    bool timed = false;
+    if (!cmds[0].argv.empty() && cmds[0].argv[0] == "timeout") {
+        Command first = expanded.empty() ? cmds[0] : expanded[0];
+        if (take_timeout(first, timeout)) {
+            if (expanded.empty()) expanded = cmds;
+            expanded[0] = std::move(first);
+            timed = true;
+        }
+    }
+    vector<Command> &run = expanded.empty() ? cmds : expanded;
+    if (timed && run.size() == 1 && run[0].argv.size() == 1 && run[0].argv[0][0] == '%')
+        return set_job_deadline(run[0].argv[0], timeout);
+
+    if (run[0].argv.size() > 1 && run[0].argv[0] == "coproc") {
+        if (run.size() > 1 || background || timed || !substs.empty()) {
+            std_err << "coproc: only a simple command can be a coprocess\n";
+            close_substs(substs);
+            return single_status(2);
+        }
+        Command cmd = run[0];
+        string name;
+        take_coproc(cmd, name);
+        return single_status(start_coproc(name, cmd, input));
+    }
+
+    if (!background && !timed && run.size() == 1 && !run[0].argv.empty()) {
+        Command &cmd = run[0];
+        // builtins that change shell state (cd, fg, export, ...) run right here;
+        // in a pipeline or in the background they run in the child instead
+        const Builtin *b = find_builtin(cmd.argv[0]);
+        bool shell_builtin = b && !b->in_child;
+        // so does an output builtin writing to a redirection (echo ... >&${CALC[1]});
+        // a reader that has gone away must not take the shell down with SIGPIPE
+        bool output_redirected = b && b->in_child && cmd.redirected() && cmd.assigns.empty();
+        // a function called on its own runs inside the shell too, no fork
+        if (output_redirected || shell_builtin || is_shell_function(cmd.argv[0])) {
+            pid_t pgid = 0;
+            vector<pid_t> helpers = start_substs(substs, pgid);
+            stage_substs(substs, 0);        // what a function runs inherits them
+            vector<SavedFd> saved;
+            int status = 1;
+            struct sigaction ign = {}, old;
+            ign.sa_handler = SIG_IGN;
+            if (output_redirected) sigaction(SIGPIPE, &ign, &old);
+            if (shell_builtin && !cmd.redirected())
+                status = call_builtin(b, cmd);
+            else if (redirect_in_shell(cmd.redirs, saved))
+                status = b && (shell_builtin || output_redirected) ? call_builtin(b, cmd) : call_function(cmd.argv, cmd.assigns);
+            restore_fds(saved);
+            if (output_redirected) sigaction(SIGPIPE, &old, nullptr);
+            end_substs(substs, helpers);
+            return single_status(status);
+        }
+    }
+
+    // run pipeline (handles creating job entries for background/stopped)
+    return runPipeline(run, background, input, timed ? &timeout : nullptr, &substs);
+}
+
+// ---- grammar ----
+// Input is parsed into a typed AST held in one flat node array (children are
+// indices into it, not pointers). A run of plain commands joined by | is kept
+// as its source text: running that leaf goes through execute_line, so it hits
+// the command cache and is expanded at run time, once per execution.
+// Heredoc bodies are collected by the scanner and spliced into that text as a
+// single quoted word after "<<", so the leaf stays self-contained.
+
+enum NodeKind : uint8_t {
+    N_NONE,         // index 0 means "no node"
+    N_SIMPLE,       // a: source string (plain commands joined by |, may end in &)
+    N_PIPELINE,     // a: first stage (linked by next), b: source string - some stage is compound
+    N_LIST,         // a: first item (linked by next), run in order
+    N_AND,          // a && b
+    N_OR,           // a || b
+    N_NOT,          // ! a
+    N_BACKGROUND,   // a &, b: source string (a is not a plain pipeline)
+    N_SUBSHELL,     // ( a ), b: source string
+    N_GROUP,        // { a; }
+    N_IF,           // if a; then b; else c; fi   (elif: c is another N_IF)
+    N_WHILE,        // while a; do b; done
+    N_UNTIL,        // until a; do b; done
+    N_FOR,          // for strings[a] in strings[b .. b+c); do d; done
+    N_CASE,         // case strings[a] in b (N_CASE_ITEMs linked by next) esac
+    N_CASE_ITEM,    // patterns strings[a .. a+c) ) b ;;
+    N_REDIRECT,     // a with redirections strings[b .. b+c): op, target pairs
+    N_FUNCDEF,      // strings[a]() b
+};
+
+struct Node {
+    NodeKind kind;
+    uint32_t a, b, c, d;
+    uint32_t next;      // next sibling (list item, pipeline stage, case item)
+};
+
+// always held by a shared_ptr: function definitions keep their tree alive
+struct Ast : enable_shared_from_this<Ast> {
+    vector<Node> nodes{Node{N_NONE, 0, 0, 0, 0, 0}};
+    vector<string> strings;     // raw source text, expanded when executed
+    uint32_t root = 0;
+};
+
+class Parser {
+public:
+    Parser(const string &src, Ast &ast) : src_(src), ast_(ast) {}
+
+    ParseStatus parse(string &error) {
+        if (!scan()) return PARSE_INCOMPLETE;
+        ast_.root = list({});
+        if (status_ == PARSE_OK && !at_end()) fail("syntax error near `" + peek().text + "'");
+        error = error_;
+        return status_;
+    }
+
+private:
+    struct Tok {
+        bool op = false;    // operator (| & ; && || ;; ( ) newline, redirections) vs word
+        string text;
+        size_t start = 0, end = 0;  // byte range in src_
+        string here = {};   // heredoc delimiter: the body as one quoted word
+    };
+
+    // ---- scanner: words are kept raw (quotes and $ intact) ----
+    static bool op_char(char c) { return strchr("|&;<>()\n", c) != nullptr; }
+    static bool proc_subst_at(const string &s, size_t i) {
+        return (s[i] == '<' || s[i] == '>') && i + 1 < s.size() && s[i + 1] == '(';
+    }
+
+    static bool ends_with(const string &t, const char *suffix) {
+        size_t len = strlen(suffix);
+        return t.size() >= len && t.compare(t.size() - len, len, suffix) == 0;
+    }
+
+    static bool is_heredoc_op(const string &t) {
+        size_t k = t.find('<');
+        return k != string::npos && (t.compare(k, string::npos, "<<") == 0 || t.compare(k, string::npos, "<<-") == 0);
+    }
+
+    // "<<-" is resolved here (tabs stripped from the body), so the rest of
+    // the shell only ever sees "<<"
+    static string plain_op(const string &t) { return ends_with(t, "<<-") ? t.substr(0, t.size() - 1) : t; }
+
+    bool scan() {
+        const string &s = src_;
+        size_t i = 0, n = s.size();
+        vector<size_t> heredocs;    // delimiter tokens whose bodies are still to be read
+        while (i < n) {
+            char c = s[i];
+            if (c == ' ' || c == '\t' || c == '\r') { ++i; continue; }
+            if (c == '\\' && i + 1 < n && s[i + 1] == '\n') { i += 2; continue; }
+            if (c == '#') {
+                while (i < n && s[i] != '\n') ++i;
+                continue;
+            }
+            // 2>, 10<&, ...: an fd number glued to a redirection is part of it
+            size_t digits = i;
+            while (digits < n && isdigit((unsigned char)s[digits])) ++digits;
+            size_t fd_len = (digits > i && digits < n && (s[digits] == '<' || s[digits] == '>') &&
+                             !proc_subst_at(s, digits)) ? digits - i : 0;
+            if (fd_len || (op_char(c) && !proc_subst_at(s, i))) {
+                size_t len = redirect_op_len(s, i + fd_len);
+                if (len) len += fd_len;
+                else if (i + 1 < n && ((c == '&' && s[i + 1] == '&') || (c == '|' && s[i + 1] == '|') ||
+                                       (c == ';' && s[i + 1] == ';')))
+                    len = 2;
+                else len = 1;
+                toks_.push_back(Tok{true, s.substr(i, len), i, i + len, string()});
+                i += len;
+                if (is_heredoc_op(toks_.back().text)) heredocs.push_back(toks_.size());
+                // bodies start on the line after the one that asked for them
+                if (c == '\n' && !heredocs.empty() && !read_heredocs(i, heredocs)) return false;
+                continue;
+            }
+            size_t start = i;
+            while (i < n && (proc_subst_at(s, i) || (!op_char(s[i]) && s[i] != ' ' && s[i] != '\t' && s[i] != '\r'))) {
+                if (s[i] == '\\') {
+                    i += 2;
+                } else if (proc_subst_at(s, i)) {
+                    // <(cmd) / >(cmd) is part of a word, not a redirection
+                    i = find_subst_end(s, i + 2);
+                    if (i == string::npos) return false;
+                    ++i;
+                } else if (s[i] == '\'') {
+                    i = s.find('\'', i + 1);
+                    if (i == string::npos) return false;
+                    ++i;
+                } else if (s[i] == '"') {
+                    for (++i; i < n && s[i] != '"'; ++i) {
+                        if (s[i] == '\\') ++i;
+                        else if (s.compare(i, 2, "$(") == 0) {
+                            i = find_subst_end(s, i + 2);
+                            if (i == string::npos) return false;
+                        }
+                    }
+                    if (i >= n) return false;
+                    ++i;
+                } else if (s.compare(i, 2, "$(") == 0) {
+                    i = find_subst_end(s, i + 2);
+                    if (i == string::npos) return false;
+                    ++i;
+                } else if (s[i] == '`') {
+                    for (++i; i < n && s[i] != '`'; ++i)
+                        if (s[i] == '\\') ++i;
+                    if (i >= n) return false;
+                    ++i;
+                } else {
+                    ++i;
+                }
+            }
+            if (i > n) i = n;
+            toks_.push_back(Tok{false, s.substr(start, i - start), start, i, string()});
+        }
+        return heredocs.empty();     // a pending body means more lines are needed
+    }
+
+    // Read the bodies for the delimiter tokens in pending, starting at src_[i].
+    // Returns false if the input ends before a terminating line.
+    bool read_heredocs(size_t &i, vector<size_t> &pending) {
+        const string &s = src_;
+        for (size_t at : pending) {
+            if (at >= toks_.size() || toks_[at].op) continue;   // parser reports it
+            bool strip_tabs = ends_with(toks_[at - 1].text, "<<-");
+            const string &raw = toks_[at].text;
+            bool quoted = raw.find_first_of("'\"\\") != string::npos;
+            string delim;
+            for (char ch : raw) if (ch != '\'' && ch != '"' && ch != '\\') delim += ch;
+            string body;
+            bool found = false;
+            while (i < s.size()) {
+                size_t e = s.find('\n', i);
+                if (e == string::npos) e = s.size();
+                size_t from = i;
+                if (strip_tabs) while (from < e && s[from] == '\t') ++from;
+                i = min(e + 1, s.size());
+                if (s.compare(from, e - from, delim) == 0 && e - from == delim.size()) {
+                    found = true;
+                    break;
+                }
+                body.append(s, from, e - from);
+                body += '\n';
+            }
+            if (!found) return false;
+            toks_[at].here = quote_body(body, !quoted);
+        }
+        pending.clear();
+        return true;
+    }
+
+    // A heredoc body as one word for parseInput: double-quoted when it is
+    // subject to $VAR / $(cmd) expansion, single-quoted when the delimiter
+    // was quoted. Backslash keeps its heredoc meaning (it only escapes
+    // $, `, \ and newline), so a literal " is escaped for the quotes.
+    static string quote_body(const string &body, bool expand) {
+        string out(1, expand ? '"' : '\'');
+        for (size_t k = 0; k < body.size(); ++k) {
+            char ch = body[k];
+            if (!expand) {
+                if (ch == '\'') out += "'\\''";
+                else out += ch;
+            } else if (ch == '"') {
+                out += "\\\"";
+            } else if (ch == '\\' && k + 1 < body.size()) {
+                char next = body[++k];
+                if (next == '\n') continue;            // line continuation
+                if (next == '"') out += "\\\\\\\"";   // literal backslash and quote
+                else if (strchr("$`\\", next)) { out += ch; out += next; }
+                else { out += ch; --k; }
+            } else {
+                out += ch;
+            }
+        }
+        out += expand ? '"' : '\'';
+        return out;
+    }
+
+    // ---- token helpers ----
+    bool at_end() const { return pos_ >= toks_.size(); }
+    const Tok &peek() const { static Tok eof{true, "", 0, 0}; return at_end() ? eof : toks_[pos_]; }
+    bool is_op(const char *op) const { return !at_end() && peek().op && peek().text == op; }
+    bool is_word(const char *w) const { return !at_end() && !peek().op && peek().text == w; }
+    void skip_newlines() { while (is_op("\n")) ++pos_; }
+
+    void fail(const string &msg) {
+        if (status_ != PARSE_OK) return;
+        // running out of input inside a construct just means "keep reading"
+        status_ = at_end() ? PARSE_INCOMPLETE : PARSE_ERROR;
+        error_ = msg;
+    }
+
+    bool expect_word(const char *w) {
+        if (is_word(w)) { ++pos_; return true; }
+        fail(string("syntax error: expected `") + w + "'");
+        return false;
+    }
+
+    bool expect_op(const char *op) {
+        if (is_op(op)) { ++pos_; return true; }
+        fail(string("syntax error: expected `") + op + "'");
+        return false;
+    }
+
+    uint32_t node(NodeKind k, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0, uint32_t d = 0) {
+        ast_.nodes.push_back(Node{k, a, b, c, d, 0});
+        return ast_.nodes.size() - 1;
+    }
+
+    uint32_t str(const string &text) {
+        ast_.strings.push_back(text);
+        return ast_.strings.size() - 1;
+    }
+
+    string source(size_t from, size_t to) const { return src_.substr(from, to - from); }
+
+    // source text of tokens [from, to) with each heredoc delimiter replaced
+    // by its body (which itself sits after the end of the line)
+    string text(size_t from, size_t to) const {
+        string out;
+        size_t at = toks_[from].start;
+        for (size_t k = from; k < to; ++k) {
+            const Tok &t = toks_[k];
+            if (t.here.empty() && !(t.op && ends_with(t.text, "<<-"))) continue;
+            out.append(src_, at, t.start - at);
+            out += t.here.empty() ? plain_op(t.text) : " " + t.here;
+            at = t.end;
+        }
+        out.append(src_, at, toks_[to - 1].end - at);
+        return out;
+    }
+
+    static bool redirect_op(const Tok &t) { return t.op && t.text.find_first_of("<>") != string::npos; }
+
+    // a list ends at EOF, ')', ';;' or one of the given reserved words
+    bool at_list_end(const vector<const char*> &stops) const {
+        if (at_end() || is_op(")") || is_op(";;")) return true;
+        for (const char *w : stops) if (is_word(w)) return true;
+        return false;
+    }
+
+    // list := and_or ((';' | '&' | newline) and_or)*
+    uint32_t list(const vector<const char*> &stops) {
+        uint32_t first = 0, last = 0, count = 0;
+        while (status_ == PARSE_OK) {
+            while (is_op("\n") || is_op(";")) ++pos_;
+            if (at_list_end(stops)) break;
+            size_t start = peek().start;
+            uint32_t item = and_or();
+            if (status_ != PARSE_OK) break;
+            if (is_op("&")) {
+                size_t end = peek().end;
+                ++pos_;
+                if (ast_.nodes[item].kind == N_SIMPLE) ast_.strings[ast_.nodes[item].a] += " &";
+                else item = node(N_BACKGROUND, item, str(source(start, end)));
+            } else if (!at_list_end(stops) && !is_op(";") && !is_op("\n")) {
+                fail("syntax error near `" + peek().text + "'");
+                break;
+            }
+            if (!first) first = item;
+            else ast_.nodes[last].next = item;
+            last = item;
+            ++count;
+        }
+        if (count == 1) return first;
+        return node(N_LIST, first);
+    }
+
+    // and_or := pipeline (('&&' | '||') newline* pipeline)*
+    uint32_t and_or() {
+        uint32_t left = pipeline();
+        while (status_ == PARSE_OK && (is_op("&&") || is_op("||"))) {
+            NodeKind k = is_op("&&") ? N_AND : N_OR;
+            ++pos_;
+            skip_newlines();
+            uint32_t right = pipeline();
+            left = node(k, left, right);
+        }
+        return left;
+    }
+
+    // pipeline := ['!'] command ('|' newline* command)*
+    uint32_t pipeline() {
+        bool negate = false;
+        if (is_word("!")) { negate = true; ++pos_; }
+        size_t start = peek().start, first_tok = pos_;
+        vector<uint32_t> stages;
+        stages.push_back(command());
+        while (status_ == PARSE_OK && is_op("|")) {
+            ++pos_;
+            skip_newlines();
+            stages.push_back(command());
+        }
+        if (status_ != PARSE_OK) return 0;
+        size_t end = toks_[pos_ - 1].end;
+        uint32_t result = stages[0];
+        if (stages.size() > 1) {
+            bool plain = true;
+            for (uint32_t st : stages) if (ast_.nodes[st].kind != N_SIMPLE) plain = false;
+            if (plain) {
+                // all plain: keep the whole pipeline as one source leaf
+                result = node(N_SIMPLE, str(text(first_tok, pos_)));
+            } else {
+                for (size_t k = 1; k < stages.size(); ++k) ast_.nodes[stages[k - 1]].next = stages[k];
+                result = node(N_PIPELINE, stages[0], str(source(start, end)));
+            }
+        }
+        return negate ? node(N_NOT, result) : result;
+    }
+
+    static bool reserved(const string &w) {
+        static const char *words[] = { "if", "then", "elif", "else", "fi", "while", "until",
+                                       "do", "done", "for", "case", "esac", "{", "}", "!" };
+        for (const char *r : words) if (w == r) return true;
+        return false;
+    }
+
+    uint32_t command() {
+        if (at_end()) { fail("syntax error: unexpected end of input"); return 0; }
+        size_t start = peek().start;
+        uint32_t n = 0;
+        if (is_op("(")) {
+            ++pos_;
+            uint32_t body = list({});
+            expect_op(")");
+            n = node(N_SUBSHELL, body, str(source(start, toks_[pos_ - 1].end)));
+        } else if (is_word("{")) {
+            ++pos_;
+            uint32_t body = list({"}"});
+            expect_word("}");
+            n = node(N_GROUP, body);
+        } else if (is_word("if")) {
+            n = if_clause();
+        } else if (is_word("while") || is_word("until")) {
+            NodeKind k = is_word("while") ? N_WHILE : N_UNTIL;
+            ++pos_;
+            uint32_t cond = list({"do"});
+            expect_word("do");
+            uint32_t body = list({"done"});
+            expect_word("done");
+            n = node(k, cond, body);
+        } else if (is_word("for")) {
+            n = for_clause();
+        } else if (is_word("case")) {
+            n = case_clause();
+        } else if (!peek().op && pos_ + 2 < toks_.size() && toks_[pos_ + 1].text == "(" &&
+                   toks_[pos_ + 1].op && toks_[pos_ + 2].text == ")" && toks_[pos_ + 2].op) {
+            return function_def();
+        } else {
+            return simple_command();
+        }
+        // redirections after a compound command
+        uint32_t first = ast_.strings.size(), count = 0;
+        while (status_ == PARSE_OK && !at_end() && redirect_op(peek())) {
+            str(plain_op(peek().text));
+            ++pos_;
+            if (at_end() || peek().op) { fail("syntax error: missing redirection target"); break; }
+            str(peek().here.empty() ? peek().text : peek().here);
+            ++pos_;
+            count += 2;
+        }
+        return count ? node(N_REDIRECT, n, first, count) : n;
+    }
+
+    uint32_t simple_command() {
+        size_t first_tok = pos_;
+        bool any = false;
+        while (!at_end()) {
+            const Tok &t = peek();
+            if (t.op) {
+                if (!redirect_op(t)) break;
+                ++pos_;
+                if (at_end() || peek().op) { fail("syntax error: missing redirection target"); return 0; }
+            } else if (!any && reserved(t.text)) {
+                break;
+            }
+            ++pos_;
+            any = true;
+        }
+        if (!any) {
+            fail("syntax error near `" + (at_end() ? string("end of input") : peek().text) + "'");
+            return 0;
+        }
+        return node(N_SIMPLE, str(text(first_tok, pos_)));
+    }
+
+    // NAME () compound-command
+    uint32_t function_def() {
+        const string &name = peek().text;
+        if (!is_name_start(name[0]) || assignment_name_len(name + "=") != name.size() || reserved(name)) {
+            fail("syntax error: `" + name + "' is not a valid function name");
+            return 0;
+        }
+        uint32_t n = str(name);
+        pos_ += 3;
+        skip_newlines();
+        if (at_end()) { fail("syntax error: expected a function body"); return 0; }
+        if (!is_op("(") && !is_word("{") && !is_word("if") && !is_word("while") &&
+            !is_word("until") && !is_word("for") && !is_word("case")) {
+            fail("syntax error: a function body must be a compound command");
+            return 0;
+        }
+        uint32_t body = command();
+        return node(N_FUNCDEF, n, body);
+    }
+
+    // if list then list (elif list then list)* [else list] fi
+    uint32_t if_clause() {
+        ++pos_;                                 // "if" or "elif"
+        uint32_t cond = list({"then"});
+        expect_word("then");
+        uint32_t body = list({"elif", "else", "fi"});
+        uint32_t other = 0;
+        if (is_word("elif")) {
+            return node(N_IF, cond, body, if_clause());
+        }
+        if (is_word("else")) {
+            ++pos_;
+            other = list({"fi"});
+        }
+        expect_word("fi");
+        return node(N_IF, cond, body, other);
+    }
+
+    // for NAME in words... (';' | newline) do list done
+    uint32_t for_clause() {
+        ++pos_;
+        if (at_end() || peek().op) { fail("syntax error: expected a name after `for'"); return 0; }
+        uint32_t var = str(peek().text);
+        ++pos_;
+        uint32_t first = ast_.strings.size(), count = 0;
+        skip_newlines();
+        if (is_word("in")) {
+            ++pos_;
+            while (!at_end() && !peek().op) {
+                str(peek().text);
+                ++pos_;
+                ++count;
+            }
+        }
+        while (is_op(";") || is_op("\n")) ++pos_;
+        expect_word("do");
+        uint32_t body = list({"done"});
+        expect_word("done");
+        return node(N_FOR, var, first, count, body);
+    }
+
+    // case WORD in [(] pat [| pat]... ) list ;; ... esac
+    uint32_t case_clause() {
+        ++pos_;
+        if (at_end() || peek().op) { fail("syntax error: expected a word after `case'"); return 0; }
+        uint32_t word = str(peek().text);
+        ++pos_;
+        skip_newlines();
+        expect_word("in");
+        uint32_t first = 0, last = 0;
+        while (status_ == PARSE_OK) {
+            skip_newlines();
+            if (is_word("esac")) break;
+            if (at_end()) { fail("syntax error: expected `esac'"); break; }
+            if (is_op("(")) ++pos_;
+            uint32_t pats = ast_.strings.size(), count = 0;
+            while (!at_end() && !peek().op) {
+                str(peek().text);
+                ++pos_;
+                ++count;
+                if (!is_op("|")) break;
+                ++pos_;
+            }
+            if (!count) { fail("syntax error: expected a case pattern"); break; }
+            if (!expect_op(")")) break;
+            uint32_t body = list({"esac"});
+            uint32_t item = node(N_CASE_ITEM, pats, body, count);
+            if (!first) first = item;
+            else ast_.nodes[last].next = item;
+            last = item;
+            if (is_op(";;")) ++pos_;
+            else if (!is_word("esac")) { fail("syntax error: expected `;;'"); break; }
+        }
+        expect_word("esac");
+        return node(N_CASE, word, first);
+    }
+
+    const string &src_;
+    Ast &ast_;
+    vector<Tok> toks_;
+    size_t pos_ = 0;
+    ParseStatus status_ = PARSE_OK;
+    string error_;
+};
+
+ParseStatus parse_source(const string &src, Ast &ast, string &error) {
+    Parser p(src, ast);
+    return p.parse(error);
+}
+
+// ---- evaluator ----
+
+// a break, continue or return is pending: stop running the current list
+static inline bool unwinding() { return sh->break_levels || sh->continue_levels || sh->returning; }
+
+// expand a raw word list (for-loop items): variables, $(cmd), globs
+vector<string> expand_words(const vector<string> &strings, size_t first, size_t count) {
+    vector<string> out;
+    DirCache cache;
+    for (size_t k = first; k < first + count; ++k) {
+        LexInfo info;
+        vector<string> words = parseInput(strings[k], &info);
+        for (size_t w = 0; w < words.size(); ++w) {
+            if (!info.patterns[w].empty()) {
+                vector<string> matches = expand_glob(info.patterns[w], cache);
+                out.insert(out.end(), matches.begin(), matches.end());
+            } else {
+                out.push_back(words[w]);
+            }
+        }
+    }
+    return out;
+}
+
+// the value of a raw word, or (as_pattern) its glob pattern with quoted parts escaped
+string expand_word(const string &raw, bool as_pattern) {
+    LexInfo info;
+    vector<string> words = parseInput(raw, &info);
+    string out;
+    for (size_t w = 0; w < words.size(); ++w) {
+        if (w) out += ' ';
+        if (!as_pattern) out += words[w];
+        else if (!info.patterns[w].empty()) out += info.patterns[w];
+        else for (char ch : words[w]) { if (strchr("*?[]\\", ch)) out += '\\'; out += ch; }
+    }
+    return out;
+}
+
+// fork a copy of the shell that runs part of the tree
+pid_t fork_subshell(pid_t pgid) {
+    std_out.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        child_setup(pgid);
+        leave_parent_shell();
+        sh->loop_depth = 0;
+    } else if (pid < 0) {
+        perror("fork");
+    }
+    return pid;
+}
+
+int eval(Ast &ast, uint32_t n);
+void define_function(const string &name, shared_ptr<Ast> ast, uint32_t body);
+
+// apply redirections in the shell itself around a compound command
+int eval_redirected(Ast &ast, const Node &nd) {
+    vector<Redirect> redirs;
+    for (uint32_t k = nd.b; k < nd.b + nd.c; k += 2)
+        add_redirect(ast.strings[k], expand_word(ast.strings[k + 1], false), redirs);
+    vector<SavedFd> saved;
+    int status = redirect_in_shell(redirs, saved) ? eval(ast, nd.a) : 1;
+    restore_fds(saved);
+    return status;
+}
+
+// a pipeline where at least one stage is a compound command
+int eval_pipeline(Ast &ast, const Node &nd) {
+    vector<uint32_t> stages;
+    for (uint32_t st = nd.a; st; st = ast.nodes[st].next) stages.push_back(st);
+    int n = stages.size();
+    vector<int> pipes(2 * (n - 1));
+    for (int i = 0; i < n - 1; ++i) {
+        if (pipe2(&pipes[2*i], O_CLOEXEC) < 0) {
+            perror("pipe");
+            return 1;
+        }
+    }
+    vector<pid_t> pids;
+    pid_t pgid = 0;
+    for (int i = 0; i < n; ++i) {
+        pid_t pid = fork_subshell(pgid);
+        if (pid < 0) break;
+        if (pid == 0) {
+            if (i > 0) dup2(pipes[2*(i-1)], STDIN_FILENO);
+            if (i < n-1) dup2(pipes[2*i + 1], STDOUT_FILENO);
+            for (int fd : pipes) close(fd);
+            const Node &stage = ast.nodes[stages[i]];
+            if (stage.kind == N_SIMPLE) {
+                // a single external command replaces this process: no second fork
+                CompiledLine scratch;
+                CompiledLine *c = compile_line(ast.strings[stage.a], scratch);
+                if (c->cmds.size() == 1 && !c->cmds[0].argv.empty() && !find_builtin(c->cmds[0].argv[0])) {
+                    vector<Command> cmds = c->cmds;
+                    expandGlobs(cmds);
+                    exec_command(cmds[0]);
+                }
+            }
+            int status = eval(ast, stages[i]);
+            std_out.flush();
+            _exit(status);
+        }
+        join_job_group(pid, pgid);
+        pids.push_back(pid);
+    }
+    for (int fd : pipes) close(fd);
+    return finish_job(pids, pgid, false, ast.strings[nd.b]);
+}
+
+// run a loop body; returns false when the loop has to stop (break)
+static bool loop_body_done(int &status, Ast &ast, uint32_t body) {
+    status = eval(ast, body);
+    if (sh->returning) return false;
+    if (sh->break_levels) { --sh->break_levels; return false; }
+    if (sh->continue_levels) {
+        if (--sh->continue_levels) return false;    // continue an outer loop
+    }
+    return true;
+}
+
+static int eval_node(Ast &ast, uint32_t n);
+
+// run node n of the tree; its status becomes $?
+int eval(Ast &ast, uint32_t n) {
+    return sh->last_exit_status = eval_node(ast, n);
+}
+
+static int eval_node(Ast &ast, uint32_t n) {
+    if (!n) return 0;
+    const Node nd = ast.nodes[n];
+    int status = 0;
+    switch (nd.kind) {
+    case N_NONE:
+        return 0;
+    case N_SIMPLE:
+        return execute_line(ast.strings[nd.a]);
+    case N_LIST:
+        for (uint32_t it = nd.a; it; it = ast.nodes[it].next) {
+            status = eval(ast, it);
+            if (unwinding()) break;
+        }
+        return status;
+    case N_AND:
+        // short-circuit in the shell itself, no fork
+        status = eval(ast, nd.a);
+        return status == 0 && !unwinding() ? eval(ast, nd.b) : status;
+    case N_OR:
+        status = eval(ast, nd.a);
+        return status != 0 && !unwinding() ? eval(ast, nd.b) : status;
+    case N_NOT:
+        return eval(ast, nd.a) == 0 ? 1 : 0;
+    case N_GROUP:
+        return eval(ast, nd.a);
+    case N_SUBSHELL:
+    case N_BACKGROUND: {
+        int log_fd = nd.kind == N_BACKGROUND ? open_job_log(ast.strings[nd.b]) : -1;
+        pid_t pid = fork_subshell(0);
+        if (pid == 0) {
+            if (log_fd >= 0) {
+                dup2(log_fd, STDOUT_FILENO);
+                dup2(log_fd, STDERR_FILENO);
+                close(log_fd);
+            }
+            status = eval(ast, nd.a);
+            std_out.flush();
+            _exit(status);
+        }
+        if (log_fd >= 0) close(log_fd);
+        if (pid < 0) {
+            if (log_fd >= 0) cancel_job_log();
+            return 1;
+        }
+        pid_t pgid = 0;
+        join_job_group(pid, pgid);
+        return finish_job({pid}, pgid, nd.kind == N_BACKGROUND, ast.strings[nd.b], log_fd >= 0);
+    }
+    case N_PIPELINE:
+        return eval_pipeline(ast, nd);
+    case N_REDIRECT:
+        return eval_redirected(ast, nd);
+    case N_IF:
+        if (eval(ast, nd.a) == 0) return eval(ast, nd.b);
+        return nd.c ? eval(ast, nd.c) : 0;
+    case N_WHILE:
+    case N_UNTIL:
+        ++sh->loop_depth;
+        while (!unwinding()) {
+            int cond = eval(ast, nd.a);
+            if (unwinding() || (cond == 0) != (nd.kind == N_WHILE)) break;
+            if (!loop_body_done(status, ast, nd.b)) break;
+        }
+        --sh->loop_depth;
+        return status;
+    case N_FOR: {
+        vector<string> items = expand_words(ast.strings, nd.b, nd.c);
+        ++sh->loop_depth;
+        for (const auto &item : items) {
+            sh->env.set(ast.strings[nd.a], item);
+            if (!loop_body_done(status, ast, nd.d)) break;
+        }
+        --sh->loop_depth;
+        return status;
+    }
+    case N_CASE: {
+        string word = expand_word(ast.strings[nd.a], false);
+        for (uint32_t it = nd.b; it; it = ast.nodes[it].next) {
+            const Node &item = ast.nodes[it];
+            for (uint32_t k = item.a; k < item.a + item.c; ++k) {
+                if (glob_match(expand_word(ast.strings[k], true).c_str(), word.c_str()))
+                    return eval(ast, item.b);
+            }
+        }
+        return 0;
+    }
+    case N_CASE_ITEM:
+        return eval(ast, nd.b);
+    case N_FUNCDEF:
+        define_function(ast.strings[nd.a], ast.shared_from_this(), nd.b);
+        return 0;
+    }
+    return status;
+}
+
+// parse and run a complete piece of source text, e.g. the body of $(...)
+int eval_source(const string &src) {
+    auto ast = make_shared<Ast>();
+    string error;
+    if (parse_source(src, *ast, error) != PARSE_OK) {
+        std_err << "myshell: " << (error.empty() ? "syntax error: unexpected end of input" : error) << "\n";
+        return 2;
+    }
+    return eval(*ast, ast->root);
+}
+
+// break [n] / continue [n]
+int builtin_break(const vector<string> &argv) {
+    if (sh->loop_depth == 0) {
+        std_err << argv[0] << ": only meaningful in a loop\n";
+        return 1;
+    }
+    int levels = argv.size() > 1 ? max(1, atoi(argv[1].c_str())) : 1;
+    levels = min(levels, sh->loop_depth);
+    if (argv[0] == "break") sh->break_levels = levels;
+    else sh->continue_levels = levels;
+    return 0;
+}
+
+// ---- shell functions ----
+// A definition stores the parsed body (a node of the tree it was parsed in,
+// kept alive through its shared_ptr) in a hash table. Calling a function runs
+// that tree inside the shell: no fork, no exec, no re-parsing. It only gets a
+// process of its own as a stage of a pipeline or in the background.
+//
+// "local" saves the variable's previous state on one stack shared by all
+// calls; a frame is just the stack height at call time, and returning pops
+// back to it, so nested calls reuse the same storage instead of allocating
+// a scope table each.
+
+void define_function(const string &name, shared_ptr<Ast> ast, uint32_t body) {
+    sh->functions[name] = Function{std::move(ast), body};
+}
+
+void remove_function(const string &name) {
+    sh->functions.erase(name);
+}
+
+bool is_shell_function(const string &name) {
+    return !sh->functions.empty() && sh->functions.count(name);
+}
+
+// save name in the current call's frame (once) before it is shadowed
+static void save_local(const string &name) {
+    for (size_t k = sh->local_frames.back(); k < sh->local_stack.size(); ++k)
+        if (sh->local_stack[k].name == name) return;
+    const Var *v = sh->env.find(name);
+    sh->local_stack.push_back(SavedVar{name, v != nullptr, v ? *v : Var()});
+}
+
+// argv[0] names the function; assigns (NAME=value prefixes) are exported
+// for the duration of the call
+int call_function(const vector<string> &argv, const vector<string> &assigns) {
+    Function fn = sh->functions.at(argv[0]);       // a copy: the body may redefine it
+    vector<string> params(argv.begin(), argv.end());
+    params[0] = sh->positional_params.empty() ? string("myshell") : sh->positional_params[0];
+    sh->positional_params.swap(params);
+    sh->local_frames.push_back(sh->local_stack.size());
+    for (const auto &a : assigns) {
+        size_t len = assignment_name_len(a);
+        save_local(a.substr(0, len));
+        sh->env.set(a.substr(0, len), a.substr(len + 1), true);
+    }
+    int saved_loop_depth = sh->loop_depth;
+    sh->loop_depth = 0;
+    ++sh->function_depth;
+
+    int status = eval(*fn.ast, fn.body);
+    sh->returning = false;
+
+    --sh->function_depth;
+    sh->loop_depth = saved_loop_depth;
+    size_t frame = sh->local_frames.back();
+    for (size_t k = sh->local_stack.size(); k-- > frame;)
+        sh->env.restore(sh->local_stack[k].name, sh->local_stack[k].was_set ? &sh->local_stack[k].var : nullptr);
+    sh->local_stack.resize(frame);
+    sh->local_frames.pop_back();
+    sh->positional_params.swap(params);
+    return status;
+}
+
+// local NAME[=value]...
+int builtin_local(const vector<string> &argv) {
+    if (sh->local_frames.empty()) {
+        std_err << "local: can only be used in a function\n";
+        return 1;
+    }
+    for (size_t k = 1; k < argv.size(); ++k) {
+        size_t len = assignment_name_len(argv[k]);
+        string name = len ? argv[k].substr(0, len) : argv[k];
+        save_local(name);
+        sh->env.set(name, len ? argv[k].substr(len + 1) : string());
+    }
+    return 0;
+}
+
+// return [n]
+int builtin_return(const vector<string> &argv) {
+    if (sh->function_depth == 0) {
+        std_err << "return: can only `return' from a function\n";
+        return 1;
+    }
+    sh->returning = true;
+    return argv.size() > 1 ? atoi(argv[1].c_str()) & 0xff : sh->last_exit_status;
+}
+
+// ---- script bytecode ----
+// A script is parsed once and compiled into a flat instruction array, so a
+// loop body runs again without re-lexing or re-resolving anything. Lines
+// without expansions are compiled all the way to Command constants built by
+// buildCommands with PATH already resolved; lines that expand $VAR or $(cmd)
+// stay as source text and go through the command cache each time they run.
+// Constructs that need a process of their own (subshells, background lists,
+// pipelines of compound commands) or redirections are handed to the
+// tree-walking evaluator.
+
+enum OpCode : uint8_t {
+    OP_RUN,             // a: line constant, b: background, c: source string - spawn pipeline
+    OP_EVAL,            // a: source string - lex and run at execution time
+    OP_EVAL_NODE,       // a: AST node for eval()
+    OP_BUILTIN,         // a: index into builtins[], b: line constant (argv = its tokens)
+    OP_SETVAR,          // a: name string, b: value string
+    OP_STATUS,          // status = a
+    OP_NOT,             // status = !status
+    OP_JUMP,            // a: target
+    OP_JUMP_IF_OK,      // a: target, taken when the last status is 0
+    OP_JUMP_IF_FAIL,    // a: target, taken when the last status is non-zero
+    OP_ITER_INIT,       // a: loop slot (also its word list)
+    OP_ITER,            // a: loop slot, b: variable name string, c: exit target
+    OP_CASE_WORD,       // a: raw word string - expanded into the case register
+    OP_CASE_MATCH,      // a: raw pattern string, b: target taken on match
+    OP_ENTER_LOOP,      // a: break target, b: continue target; status = 0
+    OP_LEAVE_LOOP,      // a: loops still running after this one
+    OP_SAVE_STATUS,     // the innermost loop's status = status (end of a while body)
+    OP_LOOP_STATUS,     // status = the innermost loop's status
+    OP_HALT,
+};
+
+struct Instr {
+    OpCode op;
+    uint32_t a, b, c;
+};
+
+struct Program {
+    vector<Instr> code;
+    vector<CompiledLine> lines;     // pipelines/builtins, already built and resolved
+    vector<string> strings;         // variable names, values, source text
+    vector<vector<string>> lists;   // word lists for OP_ITER
+    vector<bool> list_dynamic;      // list needs expansion when the loop starts
+    shared_ptr<Ast> ast = make_shared<Ast>();   // for OP_EVAL_NODE
+};
+
+class Compiler {
+public:
+    explicit Compiler(Program &prog) : p_(prog) {}
+
+    uint32_t here() const { return p_.code.size(); }
+
+    uint32_t emit(OpCode op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0) {
+        p_.code.push_back(Instr{op, a, b, c});
+        return here() - 1;
+    }
+
+    // point a forward jump (or an OP_ITER exit) at target
+    void patch(uint32_t at, uint32_t target) {
+        if (p_.code[at].op == OP_ITER) p_.code[at].c = target;
+        else p_.code[at].a = target;
+    }
+
+    uint32_t add_string(const string &str) {
+        p_.strings.push_back(str);
+        return p_.strings.size() - 1;
+    }
+
+    uint32_t add_list(vector<string> words) {
+        bool dynamic = false;
+        for (const auto &w : words)
+            if (w.find_first_of("$`*?[\'\"\\") != string::npos) dynamic = true;
+        p_.lists.push_back(std::move(words));
+        p_.list_dynamic.push_back(dynamic);
+        return p_.lists.size() - 1;
+    }
+
+    uint32_t add_line(CompiledLine line) {
+        p_.lines.push_back(std::move(line));
+        return p_.lines.size() - 1;
+    }
+
+    // one line of shell input
+    void line(string src) {
+        trim(src);
+        if (src.empty()) return;
+        if (src.find_first_of("$`") != string::npos) {
+            emit(OP_EVAL, add_string(src));
+            return;
+        }
+        CompiledLine c;
+        LexInfo info;
+        c.tokens = parseInput(src, &info);
+        if (!c.tokens.empty() && info.kinds.back() == TK_OP && c.tokens.back() == "&") {
+            c.background = true;
+            c.tokens.pop_back();
+            info.kinds.pop_back();
+            info.patterns.pop_back();
+            if (src.back() == '&') {
+                src.pop_back();
+                trim(src);
+            }
+        }
+        if (c.tokens.empty()) return;
+        if (!loops_.empty() && (c.tokens[0] == "break" || c.tokens[0] == "continue") && c.tokens.size() <= 2) {
+            loop_jump(c.tokens[0] == "break", c.tokens.size() > 1 ? atoi(c.tokens[1].c_str()) : 1);
+            return;
+        }
+        c.cmds = buildCommands(c.tokens, &info);
+        resolveCommands(c.cmds);
+        c.deps.emplace_back("PATH", param_value("PATH"));
+        if (c.cmds.empty()) return;
+
+        const Command &first = c.cmds[0];
+        bool simple = c.cmds.size() == 1 && !first.redirected() &&
+                      first.globs.empty() && first.substs.empty() && !c.background;
+        if (simple && first.argv.empty()) {
+            for (const auto &a : first.assigns) {
+                size_t len = assignment_name_len(a);
+                emit(OP_SETVAR, add_string(a.substr(0, len)), add_string(a.substr(len + 1)));
+            }
+            return;
+        }
+        const Builtin *b = find_builtin(c.tokens[0]);
+        if (b && simple && first.assigns.empty()) {
+            emit(OP_BUILTIN, b - builtins, add_line(std::move(c)));
+            return;
+        }
+        bool background = c.background;
+        emit(OP_RUN, add_line(std::move(c)), background, add_string(src));
+    }
+
+    // lower an AST node of p_.ast
+    void node(uint32_t n) {
+        if (!n) return;
+        const Node nd = p_.ast->nodes[n];
+        switch (nd.kind) {
+        case N_SIMPLE:
+            line(p_.ast->strings[nd.a]);
+            break;
+        case N_LIST:
+            for (uint32_t it = nd.a; it; it = p_.ast->nodes[it].next) node(it);
+            break;
+        case N_GROUP:
+            node(nd.a);
+            break;
+        case N_AND:
+        case N_OR: {
+            node(nd.a);
+            uint32_t skip = emit(nd.kind == N_AND ? OP_JUMP_IF_FAIL : OP_JUMP_IF_OK);
+            node(nd.b);
+            patch(skip, here());
+            break;
+        }
+        case N_NOT:
+            node(nd.a);
+            emit(OP_NOT);
+            break;
+        case N_IF: {
+            node(nd.a);
+            uint32_t to_else = emit(OP_JUMP_IF_FAIL);
+            node(nd.b);
+            uint32_t to_end = emit(OP_JUMP);
+            patch(to_else, here());
+            if (nd.c) node(nd.c);
+            else emit(OP_STATUS, 0);
+            patch(to_end, here());
+            break;
+        }
+        case N_WHILE:
+        case N_UNTIL: {
+            // the condition overwrites status, so the body's is kept in the
+            // loop's slot: the loop exits with it, or 0 if the body never ran
+            begin_loop();
+            uint32_t top = here();
+            node(nd.a);
+            uint32_t exit = emit(nd.kind == N_WHILE ? OP_JUMP_IF_FAIL : OP_JUMP_IF_OK);
+            node(nd.b);
+            uint32_t next = emit(OP_SAVE_STATUS);
+            emit(OP_JUMP, top);
+            patch(exit, here());
+            emit(OP_LOOP_STATUS);
+            end_loop(next);
+            break;
+        }
+        case N_FOR: {
+            vector<string> words(p_.ast->strings.begin() + nd.b, p_.ast->strings.begin() + nd.b + nd.c);
+            uint32_t slot = add_list(std::move(words));
+            emit(OP_ITER_INIT, slot);
+            begin_loop();
+            uint32_t top = emit(OP_ITER, slot, add_string(p_.ast->strings[nd.a]));
+            node(nd.d);
+            emit(OP_JUMP, top);
+            patch(top, here());
+            end_loop(top);
+            break;
+        }
+        case N_CASE: {
+            emit(OP_CASE_WORD, add_string(p_.ast->strings[nd.a]));
+            vector<uint32_t> to_end;
+            for (uint32_t it = nd.b; it; it = p_.ast->nodes[it].next) {
+                const Node item = p_.ast->nodes[it];
+                vector<uint32_t> matches;
+                for (uint32_t k = item.a; k < item.a + item.c; ++k)
+                    matches.push_back(emit(OP_CASE_MATCH, add_string(p_.ast->strings[k])));
+                uint32_t next_item = emit(OP_JUMP);
+                for (uint32_t m : matches) p_.code[m].b = here();
+                node(item.b);
+                to_end.push_back(emit(OP_JUMP));
+                patch(next_item, here());
+            }
+            emit(OP_STATUS, 0);
+            for (uint32_t j : to_end) patch(j, here());
+            break;
+        }
+        default:
+            emit(OP_EVAL_NODE, n);
+            break;
+        }
+    }
+
+private:
+    struct Loop {
+        uint32_t enter;                 // its OP_ENTER_LOOP
+        vector<uint32_t> breaks;        // jumps to patch with the loop's exit
+        vector<uint32_t> continues;     // jumps to patch with its continue target
+    };
+
+    // a literal break/continue is a plain jump; one that crosses loops
+    // leaves the inner ones first
+    void loop_jump(bool is_break, int levels) {
+        levels = max(1, min(levels, (int)loops_.size()));
+        size_t outer = loops_.size() - levels;
+        emit(OP_STATUS, 0);
+        if (is_break) {
+            loops_[outer].breaks.push_back(emit(OP_JUMP));
+        } else {
+            if (levels > 1) emit(OP_LEAVE_LOOP, outer + 1);
+            loops_[outer].continues.push_back(emit(OP_JUMP));
+        }
+    }
+
+    void begin_loop() {
+        loops_.push_back(Loop{emit(OP_ENTER_LOOP), {}, {}});
+    }
+
+    // next: where continue goes; break goes to the OP_LEAVE_LOOP emitted here
+    void end_loop(uint32_t next) {
+        Loop &l = loops_.back();
+        for (uint32_t j : l.breaks) patch(j, here());
+        for (uint32_t j : l.continues) patch(j, next);
+        p_.code[l.enter].a = here();
+        p_.code[l.enter].b = next;
+        loops_.pop_back();
+        emit(OP_LEAVE_LOOP, loops_.size());
+    }
+
+    Program &p_;
+    vector<Loop> loops_;
+};
+
+// A line constant was PATH-resolved when the script was compiled; a script
+// that changed PATH since gets it resolved again
+static CompiledLine &reresolve(CompiledLine &c) {
+    const string *path = sh->env.get("PATH");
+    string &seen = c.deps.front().second;
+    if (path ? *path != seen : !seen.empty()) {
+        seen = path ? *path : string();
+        resolveCommands(c.cmds);
+    }
+    return c;
+}
+
+bool compile_script(const string &text, Program &prog, string &error) {
+    if (parse_source(text, *prog.ast, error) != PARSE_OK) {
+        if (error.empty()) error = "syntax error: unexpected end of file";
+        return false;
+    }
+    Compiler comp(prog);
+    comp.node(prog.ast->root);
+    comp.emit(OP_HALT);
+    return true;
+}
+
+// A break or continue the VM did not compile into a jump (break $n, or one
+// inside a node handed to eval()) is left pending in
+// sh->break_levels/continue_levels by the builtin; the VM then jumps to the
+// target of the loop it names. Loops keep sh->loop_depth up to date so the
+// builtin accepts it anywhere in their bodies.
+struct RunningLoop {
+    uint32_t break_to, continue_to;
+    int status;
+};
+
+int run_program(Program &prog) {
+    int status = 0;
+    int base_depth = sh->loop_depth;
+    vector<RunningLoop> loops;
+    string case_word;
+    vector<size_t> slots(prog.lists.size(), 0);
+    vector<vector<string>> expanded(prog.lists.size());
+    const Instr *code = prog.code.data();
+    for (uint32_t pc = 0;;) {
+        const Instr &in = code[pc++];
+        switch (in.op) {
+        case OP_RUN:
+            status = run_compiled(reresolve(prog.lines[in.a]), in.b != 0, prog.strings[in.c]);
+            break;
+        case OP_EVAL:
+            status = execute_line(prog.strings[in.a]);
+            break;
+        case OP_EVAL_NODE:
+            status = eval(*prog.ast, in.a);
+            break;
+        case OP_BUILTIN:
+            status = single_status(builtins[in.a].fn(prog.lines[in.b].tokens));
+            std_out.flush();
+            break;
+        case OP_SETVAR:
+            sh->env.set(prog.strings[in.a], prog.strings[in.b]);
+            status = single_status(0);
+            break;
+        case OP_STATUS:
+            status = in.a;
+            break;
+        case OP_NOT:
+            status = (status == 0);
+            break;
+        case OP_JUMP:
+            pc = in.a;
+            break;
+        case OP_JUMP_IF_OK:
+            if (status == 0) pc = in.a;
+            break;
+        case OP_JUMP_IF_FAIL:
+            if (status != 0) pc = in.a;
+            break;
+        case OP_ITER_INIT:
+            slots[in.a] = 0;
+            if (prog.list_dynamic[in.a])
+                expanded[in.a] = expand_words(prog.lists[in.a], 0, prog.lists[in.a].size());
+            break;
+        case OP_ITER: {
+            const vector<string> &words = prog.list_dynamic[in.a] ? expanded[in.a] : prog.lists[in.a];
+            if (slots[in.a] < words.size())
+                sh->env.set(prog.strings[in.b], words[slots[in.a]++]);
+            else
+                pc = in.c;
+            break;
+        }
+        case OP_CASE_WORD:
+            case_word = expand_word(prog.strings[in.a], false);
+            break;
+        case OP_CASE_MATCH:
+            if (glob_match(expand_word(prog.strings[in.a], true).c_str(), case_word.c_str())) pc = in.b;
+            break;
+        case OP_ENTER_LOOP:
+            loops.push_back(RunningLoop{in.a, in.b, 0});
+            sh->loop_depth = base_depth + loops.size();
+            status = 0;
+            break;
+        case OP_LEAVE_LOOP:
+            loops.resize(in.a);
+            sh->loop_depth = base_depth + loops.size();
+            break;
+        case OP_SAVE_STATUS:
+            loops.back().status = status;
+            break;
+        case OP_LOOP_STATUS:
+            status = loops.back().status;
+            break;
+        case OP_HALT:
+            return status;
+        }
+        sh->last_exit_status = status;
+        if ((sh->break_levels || sh->continue_levels) && !loops.empty()) {
+            size_t outer = loops.size() - min<size_t>(max(sh->break_levels, sh->continue_levels), loops.size());
+            if (sh->break_levels) {
+                pc = loops[outer].break_to;
+            } else {
+                pc = loops[outer].continue_to;
+                loops.resize(outer + 1);
+                sh->loop_depth = base_depth + loops.size();
+            }
+            sh->break_levels = sh->continue_levels = 0;
+        }
+    }
+}
+
+
+// ---- server mode ----
+// myshell --serve PATH listens on a SOCK_SEQPACKET Unix socket, so every
+// request and reply is one message and needs no length prefix. A request is
+// a list of NUL-terminated fields, each a one-letter tag and a value:
+//
+//   c<command line>    required, any shell input (pipelines, lists, loops...)
+//   d<directory>       working directory
+//   e<NAME=value>      exported variable; e<NAME> unsets NAME
+//   i<id>              echoed back, so one connection can have several in flight
+//
+// Up to three fds passed with SCM_RIGHTS become the command's stdin, stdout
+// and stderr, in that order; the rest are /dev/null. Each request runs in a
+// forked copy of the already initialised shell; the reply is sent when that
+// process is reaped:
+//
+//   id=<id> status=<n> utime_us=<n> stime_us=<n> maxrss_kb=<n> real_us=<n>
+//
+// or "id=<id> error=<message>" for a malformed request.
+
+struct ServeRequest {
+    string id, command, cwd;
+    vector<string> env;
+    int fds[3] = {-1, -1, -1};
+};
+
+struct ServePending {
+    int conn;
+    string id;
+    long start_us;
+};
+
+static long monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void serve_reply(int conn, const string &msg) {
+    if (send(conn, msg.data(), msg.size(), MSG_NOSIGNAL) < 0 && errno != EPIPE && errno != ECONNRESET)
+        perror("serve: send");
+}
+
+// one message from conn; returns false when the connection is gone
+static bool serve_read(int conn, ServeRequest &rq, string &error) {
+    static char buf[65536];
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec iov = { buf, sizeof(buf) };
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) return false;
+
+    int nfds = 0;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int *fds = (int *)CMSG_DATA(c);
+        for (int k = 0; k < count; ++k) {
+            if (nfds < 3) rq.fds[nfds++] = fds[k];
+            else close(fds[k]);
+        }
+    }
+    if (msg.msg_flags & MSG_TRUNC) { error = "request too large"; return true; }
+    if (msg.msg_flags & MSG_CTRUNC) { error = "too many fds"; return true; }
+
+    for (size_t i = 0; i < (size_t)n;) {
+        const char *field = buf + i;
+        size_t len = strnlen(field, n - i);
+        string value(field + 1, len ? len - 1 : 0);
+        switch (len ? field[0] : 0) {
+        case 'c': rq.command = value; break;
+        case 'd': rq.cwd = value; break;
+        case 'e': rq.env.push_back(value); break;
+        case 'i': rq.id = value; break;
+        default: error = "bad field"; return true;
+        }
+        i += len + 1;
+    }
+    if (rq.command.empty()) error = "no command";
+    return true;
+}
+
+// child side: set up the request's context and run it
+[[noreturn]] static void serve_worker(const ServeRequest &rq) {
+    setpgid(0, 0);
+    signal(SIGPIPE, SIG_DFL);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, nullptr);
+    close(sh->sigchld_fd);
+    sh->sigchld_fd = -1;
+
+    for (int k = 0; k < 3; ++k) {
+        int fd = rq.fds[k] >= 0 ? rq.fds[k] : open("/dev/null", O_RDWR);
+        if (fd != k) dup2(fd, k);
+    }
+    if (!rq.cwd.empty() && chdir(rq.cwd.c_str()) < 0) {
+        perror(rq.cwd.c_str());
+        _exit(126);
+    }
+    for (const auto &e : rq.env) {
+        size_t eq = e.find('=');
+        if (eq == string::npos) sh->env.unset(e);
+        else sh->env.set(e.substr(0, eq), e.substr(eq + 1), true);
+    }
+    int status = eval_source(rq.command);
+    std_out.flush();
+    _exit(status);
+}
+
+int serve(const string &path) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std_err << "serve: " << path << ": path too long\n";
+        return 2;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    int lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (lfd < 0) { perror("socket"); return 1; }
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path.c_str());   // stale
+    if (bind(lfd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 128) < 0) {
+        perror(path.c_str());
+        close(lfd);
+        return 1;
+    }
+
+    // children and shutdown requests both arrive on one signalfd
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+    if (sh->sigchld_fd >= 0) close(sh->sigchld_fd);
+    sh->sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sh->sigchld_fd < 0) { perror("signalfd"); return 1; }
+    sh->job_control = false;
+    sh->interactive = false;
+
+    vector<int> conns;
+    unordered_map<pid_t, ServePending> pending;
+    bool stop = false;
+    while (!stop) {
+        vector<struct pollfd> pfds;
+        pfds.push_back({lfd, POLLIN, 0});
+        pfds.push_back({sh->sigchld_fd, POLLIN, 0});
+        for (int c : conns) pfds.push_back({c, POLLIN, 0});
+        if (poll(pfds.data(), pfds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            while (read(sh->sigchld_fd, &si, sizeof(si)) == (ssize_t)sizeof(si))
+                if (si.ssi_signo != SIGCHLD) stop = true;
+            int status;
+            struct rusage ru;
+            pid_t pid;
+            while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+                auto it = pending.find(pid);
+                if (it == pending.end()) continue;
+                int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+                char reply[256];
+                snprintf(reply, sizeof(reply),
+                         "id=%s status=%d utime_us=%ld stime_us=%ld maxrss_kb=%ld real_us=%ld",
+                         it->second.id.c_str(), code,
+                         ru.ru_utime.tv_sec * 1000000L + ru.ru_utime.tv_usec,
+                         ru.ru_stime.tv_sec * 1000000L + ru.ru_stime.tv_usec,
+                         ru.ru_maxrss, monotonic_us() - it->second.start_us);
+                if (it->second.conn >= 0) serve_reply(it->second.conn, reply);
+                pending.erase(it);
+            }
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            int c = accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (c >= 0) conns.push_back(c);
+        }
+
+        for (size_t k = 2; k < pfds.size(); ++k) {
+            if (!pfds[k].revents) continue;
+            int c = pfds[k].fd;
+            ServeRequest rq;
+            string error;
+            if (!serve_read(c, rq, error)) {
+                // client went away: stop whatever it still has running
+                for (auto &p : pending)
+                    if (p.second.conn == c) {
+                        kill(-p.first, SIGTERM);
+                        p.second.conn = -1;
+                    }
+                close(c);
+                conns.erase(find(conns.begin(), conns.end(), c));
+                continue;
+            }
+            if (error.empty()) {
+                std_out.flush();
+                pid_t pid = fork();
+                if (pid == 0) serve_worker(rq);
+                if (pid < 0) {
+                    error = strerror(errno);
+                } else {
+                    setpgid(pid, pid);
+                    pending[pid] = ServePending{c, rq.id, monotonic_us()};
+                }
+            }
+            for (int fd : rq.fds) if (fd >= 0) close(fd);
+            if (!error.empty()) serve_reply(c, "id=" + rq.id + " error=" + error);
+        }
+    }
+
+    for (auto &p : pending) kill(-p.first, SIGTERM);
+    for (int c : conns) close(c);
+    close(lfd);
+    unlink(path.c_str());
+    return 0;
+}
+
+// ---- library interface ----
+// Output the shell buffered during a call is written out before it returns.
+
+static int flushed(int status) {
+    std_out.flush();
+    return status;
+}
+
+Shell::Shell() : Shell(environ) {}
+
+Shell::Shell(char **envp) : state_(new ShellState) {
+    state_->env.import(envp);
+    state_->shell_pgid = getpgrp();
+    state_->shell_pid = getpid();
+    activate();
+}
+
+// the fds the shell opened for itself go with it
+Shell::~Shell() {
+    ShellState *st = state_.get();
+    if (st->sigchld_fd >= 0) close(st->sigchld_fd);
+    for (const auto &c : st->coprocs) {
+        close(c.read_fd);
+        close(c.write_fd);
+    }
+    for (auto &l : st->job_logs) close_job_log(l);
+    st->deadlines.clear();      // its timerfd
+    if (sh == st) sh = nullptr;
+}
+
+void Shell::activate() const {
+    sh = state_.get();
+}
+
+void Shell::attach_terminal(bool interactive) {
+    activate();
+    // ensure shell is in its own process group and has control of terminal
+    sh->shell_pgid = getpid();
+    if (setpgid(sh->shell_pgid, sh->shell_pgid) < 0) {
+        // ignore
+    }
+    // ignore interactive job-control signals in shell
+    signal(SIGTTOU, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+
+    // take control of terminal
+    sh->interactive = interactive;
+    sh->job_control = true;
+    tcsetpgrp(STDIN_FILENO, sh->shell_pgid);
+    tcgetattr(STDIN_FILENO, &sh->shell_tmodes);
+    if (interactive) {
+        signal(SIGINT, SIG_IGN);
+        signal(SIGTSTP, SIG_IGN);
+    }
+
+}
+
+void Shell::set_args(const vector<string> &args) {
+    state_->positional_params = args;
+}
+
+void Shell::set_var(const string &name, const string &value, bool exported) {
+    state_->env.set(name, value, exported);
+}
+
+string Shell::var(const string &name) const {
+    activate();
+    return param_value(name);
+}
+
+vector<string> Shell::tokenize(const string &line) {
+    activate();
+    return parseInput(line);
+}
+
+vector<Command> Shell::plan(const vector<string> &tokens) {
+    activate();
+    vector<Command> cmds = buildCommands(tokens);
+    resolveCommands(cmds);
+    return cmds;
+}
+
+ParseStatus Shell::parse(const string &source, shared_ptr<Ast> &ast, string &error) {
+    activate();
+    ast = make_shared<Ast>();
+    return parse_source(source, *ast, error);
+}
+
+shared_ptr<Program> Shell::compile(const string &source, string &error) {
+    activate();
+    auto prog = make_shared<Program>();
+    if (!compile_script(source, *prog, error)) return nullptr;
+    return prog;
+}
+
+int Shell::run(Ast &ast) {
+    activate();
+    return flushed(eval(ast, ast.root));
+}
+
+int Shell::run(Program &prog) {
+    activate();
+    return flushed(run_program(prog));
+}
+
+int Shell::run(const string &source) {
+    activate();
+    return flushed(eval_source(source));
+}
+
+int Shell::run_line(const string &line) {
+    activate();
+    return flushed(execute_line(line));
+}
+
+int Shell::run_file(const string &path) {
+    activate();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path.c_str());
+        return 127;
+    }
+    CaptureBuffer text;
+    text.read_from(fd);
+    close(fd);
+    Program prog;
+    string error;
+    if (!compile_script(string(text.view()), prog, error)) {
+        std_err << path << ": " << error << "\n";
+        return 2;
+    }
+    return flushed(run_program(prog));
+}
+
+bool Shell::read_line(const string &prompt, string &line) {
+    activate();
+    return ::read_line(prompt, line);
+}
+
+vector<Job> &Shell::jobs() {
+    return state_->jobs;
+}
+
+Job &Shell::add_job(pid_t pgid, const vector<pid_t> &pids, const string &cmd, JobStatus status) {
+    activate();
+    return ::add_job(pgid, pids, cmd, status);
+}
+
+Job *Shell::find_job(int jid) {
+    activate();
+    return find_job_by_jid(jid);
+}
+
+Job *Shell::find_job_by_pid(pid_t pid) {
+    activate();
+    return ::find_job_by_pid(pid);
+}
+
+void Shell::remove_job(pid_t pgid) {
+    activate();
+    remove_job_by_pgid(pgid);
+}
+
+void Shell::print_jobs() {
+    activate();
+    ::print_jobs();
+    std_out.flush();
+}
+
+void Shell::update_jobs() {
+    activate();
+    ::update_jobs();
+}
+
+int Shell::serve(const string &path) {
+    activate();
+    return ::serve(path);
+}
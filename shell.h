@@ -0,0 +1,133 @@
+// myshell as a library: the parser, the pipeline runner and the job table
+// behind one Shell object, so they can be driven from a benchmark or
+// embedded in another process. main.cpp is the interactive front end.
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+enum JobStatus { RUNNING, STOPPED, DONE };
+
+struct Job {
+    int jid = 0;            // job id (%n)
+    pid_t pgid = 0;         // process group id
+    std::vector<pid_t> pids = {};   // processes not yet reaped
+    std::string cmd = {};
+    JobStatus status = RUNNING;
+    pid_t last_pid = 0;     // final stage: its exit status is the job's
+    int exit_status = 0;    // set once last_pid has exited
+    std::string reason = {};    // why the shell signalled it ("timed out"), shown by jobs
+
+    // filled in from wait4 as each process is reaped (jobs -l, jobs --json)
+    std::vector<pid_t> stages = {};     // every process, in pipeline order
+    std::vector<int> stage_status = {}; // exit status per stage, -1 until it exits
+    int64_t started_ms = 0;         // CLOCK_MONOTONIC
+    int64_t ended_ms = 0;           // 0 while a process is left
+    int64_t utime_us = 0, stime_us = 0;     // CPU of the reaped processes, summed
+    long maxrss_kb = 0;             // largest of theirs
+    bool summarized = false;        // finished and already listed by jobs -l / --json
+};
+
+enum RedirOp : uint8_t {
+    R_READ,         // n<file
+    R_WRITE,        // n>file
+    R_APPEND,       // n>>file
+    R_READWRITE,    // n<>file
+    R_DUP,          // n>&m, n<&m: target is m
+    R_CLOSE,        // n>&-, n<&-
+    R_HERE,         // n<<EOF, n<<<word: target is the text itself
+};
+
+// one redirection; a command applies its list in the order written
+struct Redirect {
+    int fd;
+    RedirOp op;
+    std::string target;
+};
+
+// <(cmd) or >(cmd) in a word: a pipe to cmd, made afresh on every run,
+// whose path /dev/fd/N is spliced into the word at offset
+struct ProcSubst {
+    bool redirect = false;  // the word is redirs[index].target, else argv[index]
+    size_t index = 0;
+    size_t offset = 0;
+    bool output = false;    // >(cmd): the command writes, cmd reads
+    std::string text;
+};
+
+// one stage of a pipeline
+struct Command {
+    std::vector<std::string> argv;
+    std::string exec_path;       // resolved from PATH at build time (empty: let execvp search)
+    std::vector<std::string> assigns; // NAME=value prefixes, layered over the shell environment
+    std::vector<std::pair<size_t, std::string>> globs;  // argv index -> pattern, expanded at run time
+    std::vector<Redirect> redirs;
+    std::vector<ProcSubst> substs;  // started at run time, before the stage
+
+    bool redirected() const { return !redirs.empty(); }
+};
+
+enum ParseStatus { PARSE_OK, PARSE_INCOMPLETE, PARSE_ERROR };
+
+struct Ast;         // parsed source (the full grammar)
+struct Program;     // a script compiled to bytecode
+struct ShellState;
+
+// A shell: variables, functions, options, the command cache and the job
+// table. Each call makes this shell the current one; only one may be
+// running at a time in a process.
+class Shell {
+public:
+    // starts with the variables of environ (or envp), no job control
+    Shell();
+    explicit Shell(char **envp);
+    ~Shell();
+    Shell(const Shell &) = delete;
+    Shell &operator=(const Shell &) = delete;
+
+    // Front end setup: own process group, job control and, when interactive,
+    // the terminal. Affects the whole process. Children are watched through
+    // a SIGCHLD signalfd from the first read_line on.
+    void attach_terminal(bool interactive);
+
+    void set_args(const std::vector<std::string> &args);    // $0 $1 ...
+    void set_var(const std::string &name, const std::string &value, bool exported = false);
+    std::string var(const std::string &name) const;
+
+    // words of one line: quoting removed, variables and $(...) expanded
+    std::vector<std::string> tokenize(const std::string &line);
+    // pipeline stages for tokens, with redirections split off and PATH resolved
+    std::vector<Command> plan(const std::vector<std::string> &tokens);
+    // full grammar; PARSE_INCOMPLETE means more lines are needed
+    ParseStatus parse(const std::string &source, std::shared_ptr<Ast> &ast, std::string &error);
+    // a whole script lowered onto the bytecode VM
+    std::shared_ptr<Program> compile(const std::string &source, std::string &error);
+
+    int run(Ast &ast);
+    int run(Program &prog);
+    int run(const std::string &source);         // parse and run
+    int run_line(const std::string &line);      // one line through the command cache
+    int run_file(const std::string &path);      // compile and run a script file
+
+    // answer requests on a Unix socket until SIGINT/SIGTERM (see shell.cpp)
+    int serve(const std::string &path);
+
+    // prompt and read one line, reporting finished jobs meanwhile; false on EOF
+    bool read_line(const std::string &prompt, std::string &line);
+
+    std::vector<Job> &jobs();
+    Job &add_job(pid_t pgid, const std::vector<pid_t> &pids, const std::string &cmd, JobStatus status);
+    Job *find_job(int jid);
+    Job *find_job_by_pid(pid_t pid);
+    void remove_job(pid_t pgid);
+    void print_jobs();
+    void update_jobs();     // reap children that changed state
+
+private:
+    void activate() const;
+
+    std::unique_ptr<ShellState> state_;
+};
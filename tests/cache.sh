@@ -0,0 +1,48 @@
+#!/bin/sh
+# The compiled-line cache: an entry is recompiled when a variable it expanded,
+# PATH or a function it names changes, and hash -r empties it.
+# usage: tests/cache.sh path/to/myshell
+sh_under_test=$(realpath "${1:-build/myshell}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+mkdir "$dir/d1" "$dir/d2"
+printf '#!/bin/sh\necho one\n' > "$dir/d1/tool"
+printf '#!/bin/sh\necho two\n' > "$dir/d2/tool"
+chmod +x "$dir/d1/tool" "$dir/d2/tool"
+fail=0
+
+check() {
+    got=$(cd "$dir" && "$sh_under_test" -c "$1" 2>&1)
+    if [ "$got" != "$2" ]; then
+        printf 'FAIL: %s\n  expected: %s\n  got:      %s\n' "$1" "$2" "$got"
+        fail=1
+    fi
+}
+
+stat='hash | head -1 | grep -o "invalidated [0-9]*"'
+
+# a variable the line expanded
+check "X=1; echo \$X; X=2; echo \$X; $stat"                     '1
+2
+invalidated 1'
+check "X=1; echo \$X; Y=2; echo \$X; $stat"                     '1
+1
+invalidated 0'
+# PATH: the same line finds the command again
+check "O=\$PATH; PATH=\$PWD/d1:\$O; tool; PATH=\$PWD/d2:\$O; tool; $stat" 'one
+two
+invalidated 1'
+# defining or removing a function of the same name
+check 'PATH=$PWD/d1:$PATH; tool; tool() { echo fn; }; tool; unset -f tool; tool' 'one
+fn
+one'
+# hash -r drops every entry
+check 'echo a; echo a; hash -r; hash | head -1 | grep -o "entries [0-9]*"' 'a
+a
+entries 1'
+check 'echo a; hash -r; echo a; hash | head -1 | grep -o "hits [0-9]*"'   'a
+a
+hits 0'
+
+[ $fail = 0 ] && echo "cache: ok"
+exit $fail
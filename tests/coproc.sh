@@ -0,0 +1,31 @@
+#!/bin/sh
+# Coprocesses, and that forks of the shell which never exec (subshells,
+# $(...), function stages, <(...), a coprocess that is a function) do not
+# keep the coproc pipes or other shell-internal fds open.
+# usage: tests/coproc.sh path/to/myshell
+sh_under_test=$(realpath "${1:-build/myshell}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+fail=0
+
+check() {
+    got=$(cd "$dir" && "$sh_under_test" -c "$1" </dev/null 2>&1)
+    if [ "$got" != "$2" ]; then
+        printf 'FAIL: %s\n  expected: %s\n  got:      %s\n' "$1" "$2" "$got"
+        fail=1
+    fi
+}
+
+# fds above 2 held by the calling process (a fork of the shell under test)
+fds='sh -c "ls /proc/\$PPID/fd | awk \"\\\$1 > 2\" | wc -l"'
+
+check 'coproc cat; read_fd=${COPROC[0]}; write_fd=${COPROC[1]}; echo hi >&$write_fd; read l <&$read_fd; echo $l' 'hi'
+check 'coproc UP sh -c "read l; echo up \$l"; echo abc >&${UP[1]}; read l <&${UP[0]}; echo $l' 'up abc'
+check "coproc cat; ( $fds )"                                 '0'
+check "coproc cat; echo \$($fds)"                            '0'
+check "coproc cat; f() { $fds; }; f | cat"                   '0'
+check "coproc cat; cat <($fds)"                              '0'
+check "coproc cat; g() { $fds; }; coproc G g; read n <&\${G[0]}; echo \$n" '0'
+
+[ $fail = 0 ] && echo "coproc: ok"
+exit $fail
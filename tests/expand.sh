@@ -0,0 +1,45 @@
+#!/bin/sh
+# Parameter expansion: field splitting of unquoted $NAME, the ${NAME:-word}
+# family and $$.
+# usage: tests/expand.sh path/to/myshell
+sh_under_test=$(realpath "${1:-build/myshell}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+touch "$dir/a.c" "$dir/b.c"
+fail=0
+
+check() {
+    got=$(cd "$dir" && "$sh_under_test" -c "$1" 2>&1)
+    if [ "$got" != "$2" ]; then
+        printf 'FAIL: %s\n  expected: %s\n  got:      %s\n' "$1" "$2" "$got"
+        fail=1
+    fi
+}
+
+# unquoted $NAME is split on IFS and globbed; quoted and assigned values are not
+check 'L="a b c"; for x in $L; do echo $x; done'        'a
+b
+c'
+check 'X="-l -a"; printf "[%s]" $X'                      '[-l][-a]'
+check 'X="-l -a"; printf "[%s]" "$X"'                    '[-l -a]'
+check 'E=; printf "[%s]" a $E b'                         '[a][b]'
+check 'S=" x y "; printf "[%s]" p${S}q'                  '[p][x][y][q]'
+check 'IFS=:; V=a:b; printf "[%s]" $V'                   '[a][b]'
+check 'Y="a  b"; Z=$Y; printf "[%s]" "$Z"'               '[a  b]'
+check 'x=$(printf "1\n2"); echo "$x"'                    '1
+2'
+check 'P="*.c"; echo $P "$P"'                            'a.c b.c *.c'
+# ${NAME op word}
+check 'E=; echo ${NOPE:-d1} ${NOPE-d2} ${E:-d3} ${E-d4}.' 'd1 d2 d3 .'
+check 'S=v; E=; echo ${S:+alt} ${NOPE:+alt} ${E+set}.'   'alt set.'
+check 'echo ${NEW:=val} $NEW'                            'val val'
+check 'L="x y"; echo ${NOPE:-$L}'                        'x y'
+check 'echo ${NOPE:?is missing}; echo $?'                'myshell: NOPE: is missing
+1'
+check 'echo ${L%x}; echo $?'                             'myshell: ${L%x}: bad substitution
+1'
+# $$ is the shell's pid, also inside subshells
+check 'a=$$; b=$(echo $$); [ $a = $b ] && echo same'     'same'
+
+[ $fail = 0 ] && echo "expand: ok"
+exit $fail
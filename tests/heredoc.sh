@@ -0,0 +1,53 @@
+#!/bin/sh
+# Here-documents and here-strings: the pipe path for bodies that fit the pipe
+# buffer, the sealed memfd path for larger ones, <<- tab stripping, quoted
+# delimiters and <<<.
+# usage: tests/heredoc.sh path/to/myshell
+sh_under_test=$(realpath "${1:-build/myshell}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+fail=0
+tab=$(printf '\t')
+
+check() {
+    got=$(cd "$dir" && "$sh_under_test" -c "$1" 2>&1)
+    if [ "$got" != "$2" ]; then
+        printf 'FAIL: %s\n  expected: %s\n  got:      %s\n' "$1" "$2" "$got"
+        fail=1
+    fi
+}
+
+# a small body arrives through a pipe
+check 'readlink /proc/self/fd/0 <<EOF | cut -d: -f1
+small
+EOF'                                                            'pipe'
+check 'X=v; cat <<EOF
+a $X
+EOF'                                                            'a v'
+# a body larger than the 64K pipe buffer comes from a sealed memfd, intact
+big=$(awk 'BEGIN { for (i = 0; i < 10000; i++) printf "line %05d\n", i }')
+check "readlink /proc/self/fd/0 <<EOF
+$big
+EOF"                                                            '/memfd:heredoc (deleted)'
+check "wc -c <<EOF
+$big
+EOF"                                                            '110000'
+check "tail -1 <<EOF
+$big
+EOF"                                                            'line 09999'
+# <<- strips leading tabs from the body and the delimiter line
+check "cat <<-EOF
+${tab}${tab}one
+${tab}two  x
+${tab}EOF"                                                      'one
+two  x'
+# a quoted delimiter turns expansion off
+check 'X=v; cat <<'"'EOF'"'
+a $X $(echo no)
+EOF'                                                            'a $X $(echo no)'
+# here-strings
+check 'X=v; cat <<< "s $X"'                                     's v'
+check 'wc -l <<< one'                                           '1'
+
+[ $fail = 0 ] && echo "heredoc: ok"
+exit $fail
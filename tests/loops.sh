@@ -0,0 +1,42 @@
+#!/bin/sh
+# Loop exit status and break/continue, under both engines: -c runs the
+# tree-walking evaluator, a script file runs the bytecode VM.
+# usage: tests/loops.sh path/to/myshell
+sh_under_test=$(realpath "${1:-build/myshell}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+fail=0
+
+check() {
+    printf '%s\n' "$1" > "$dir/script"
+    for engine in -c script; do
+        if [ $engine = -c ]; then
+            got=$(cd "$dir" && "$sh_under_test" -c "$1" 2>&1)
+        else
+            got=$(cd "$dir" && "$sh_under_test" script 2>&1)
+        fi
+        if [ "$got" != "$2" ]; then
+            printf 'FAIL (%s): %s\n  expected: %s\n  got:      %s\n' "$engine" "$1" "$2" "$got"
+            fail=1
+        fi
+    done
+}
+
+# a loop's status is its body's last status, 0 if the body never ran
+check 'i=0; while [ $i -lt 1 ]; do i=1; false; done; echo $?'  '1'
+check 'until true; do false; done; echo $?'                      '0'
+check 'for x in a; do false; done; echo $?'                      '1'
+check 'for x in; do false; done; echo $?'                        '0'
+check 'for x in a b; do false; break; done; echo $?'             '0'
+# break/continue with an expanded level count
+check 'N=1; for x in a b c; do echo $x; break $N; done'          'a'
+check 'N=2; for x in a b; do for y in 1 2; do echo $x$y; break $N; done; done; echo end' 'a1
+end'
+check 'N=2; for x in a b; do for y in 1 2; do echo $x$y; continue $N; echo no; done; done' 'a1
+b1'
+check 'for x in a b; do for y in 1 2; do echo $x$y; continue 2; done; done' 'a1
+b1'
+check 'for x in a b c; do if [ $x = b ]; then continue; fi; if [ $x = c ]; then break; fi; echo $x; done' 'a'
+
+[ $fail = 0 ] && echo "loops: ok"
+exit $fail
@@ -0,0 +1,41 @@
+#!/bin/sh
+# PIPESTATUS, $? and pipefail for pipelines that mix stages the shell runs
+# itself (see "pipeline stage fusion" in shell.cpp) with forked ones.
+# usage: tests/pipestatus.sh path/to/myshell
+sh_under_test=$(realpath "${1:-build/myshell}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+printf 'a\nb\nc\n' > "$dir/f"
+fail=0
+
+check() {
+    got=$(cd "$dir" && "$sh_under_test" -c "$1" 2>&1)
+    if [ "$got" != "$2" ]; then
+        printf 'FAIL: %s\n  expected: %s\n  got:      %s\n' "$1" "$2" "$got"
+        fail=1
+    fi
+}
+
+# forked producer feeding a builtin stage: the builtin is not fused
+check 'true | echo x; echo ${PIPESTATUS[@]}'                    'x
+0 0'
+check 'false | echo x; echo $? ${PIPESTATUS[@]}'                'x
+0 1 0'
+check 'set -o pipefail; false | echo x; echo $? ${PIPESTATUS[@]}' 'x
+1 1 0'
+check 'set -o pipefail; true | echo x; echo $?'                  'x
+0'
+# fused prefix feeding forked stages
+check 'echo hi | tr a-z A-Z; echo ${PIPESTATUS[@]}'             'HI
+0 0'
+check 'false | true | cat; echo $? ${PIPESTATUS[@]}'            '0 1 0 0'
+check 'set -o pipefail; false | true | cat; echo $?'             '1'
+check 'cat f | grep b; echo ${PIPESTATUS[@]}'                   'b
+0 0'
+check 'cat f | head -1 | cat; echo ${PIPESTATUS[@]}'            'a
+0 0 0'
+check 'echo a | echo b; echo ${PIPESTATUS[@]}'                  'b
+0 0'
+
+[ $fail = 0 ] && echo "pipestatus: ok"
+exit $fail
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Process substitution: <(cmd) and >(cmd) as /dev/fd paths, and that running
+# the same line again and again leaves no fds behind in the shell.
+# usage: tests/procsubst.sh path/to/myshell
+sh_under_test=$(realpath "${1:-build/myshell}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+fail=0
+
+check() {
+    got=$(cd "$dir" && "$sh_under_test" -c "$1" 2>&1)
+    if [ "$got" != "$2" ]; then
+        printf 'FAIL: %s\n  expected: %s\n  got:      %s\n' "$1" "$2" "$got"
+        fail=1
+    fi
+}
+
+check "diff <(printf 'a\n') <(printf 'a\n'); echo \$?"          '0'
+check "diff <(printf 'a\n') <(printf 'b\n') >/dev/null; echo \$?" '1'
+check 'cat <(echo x) <(echo y)'                                 'x
+y'
+check 'wc -l < <(printf "1\n2\n")'                              '2'
+check 'f() { cat "$1"; }; f <(echo arg)'                        'arg'
+check 'echo hi > >(cat > out); sleep 0.2; cat out'              'hi'
+# the same line, run many times from a loop (script bytecode and evaluator)
+# and from the line cache: the shell's fd count does not grow
+leak="for i in 1 2 3 4 5 6 7 8; do diff <(printf 'a\n') <(printf 'a\n') >/dev/null; done"
+check "$leak; n=\$(ls /proc/\$\$/fd | wc -l); $leak; $leak; m=\$(ls /proc/\$\$/fd | wc -l); [ \$n = \$m ] && echo same" 'same'
+printf '%s\n' "$leak" 'n=$(ls /proc/$$/fd | wc -l)' "$leak" "$leak" \
+    'm=$(ls /proc/$$/fd | wc -l)' '[ $n = $m ] && echo same' > "$dir/script"
+got=$(cd "$dir" && "$sh_under_test" script 2>&1)
+if [ "$got" != same ]; then
+    printf 'FAIL: fds left behind by a script loop\n  got: %s\n' "$got"
+    fail=1
+fi
+check "cat <(echo a) >/dev/null; n=\$(ls /proc/\$\$/fd | wc -l); cat <(echo a) >/dev/null; cat <(echo a) >/dev/null; [ \$n = \$(ls /proc/\$\$/fd | wc -l) ] && echo same" 'same'
+
+[ $fail = 0 ] && echo "procsubst: ok"
+exit $fail
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Redirections of external commands go through the parallel-move planner
+# (see "redirections" in shell.cpp): cycles, ordering, &> / &>> and n<>.
+# usage: tests/redirect.sh path/to/myshell
+sh_under_test=$(realpath "${1:-build/myshell}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+fail=0
+
+check() {
+    got=$(cd "$dir" && rm -f f g && "$sh_under_test" -c "$1" 2>&1)
+    if [ "$got" != "$2" ]; then
+        printf 'FAIL: %s\n  expected: %s\n  got:      %s\n' "$1" "$2" "$got"
+        fail=1
+    fi
+}
+
+both="sh -c 'echo out; echo err >&2'"
+
+# the swap cycle needs a temporary: stdout and stderr trade places
+check "$both 3>&1 1>&2 2>&3 2>/dev/null | tr a-z A-Z"          'out'
+check "($both 3>&1 1>&2 2>&3 | tr a-z A-Z) 2>/dev/null"        'ERR'
+check "($both 3>&1 1>&2 2>&3 | tr a-z A-Z) 2>f; cat f"         'ERR
+out'
+check "echo x 3>&1 1>&2 2>&3 | tr a-z A-Z"                     'x'
+# left to right: 2>&1 >f sends stderr to the old stdout, >f 2>&1 to f
+check "$both 2>&1 >f | tr a-z A-Z; cat f"                      'ERR
+out'
+check "$both >f 2>&1 | tr a-z A-Z; cat f"                      'out
+err'
+# &> truncates, &>> appends, both take stdout and stderr
+check "echo old >f; $both &>f; cat f"                          'out
+err'
+check "echo old >f; $both &>>f; cat f"                         'old
+out
+err'
+# n<> opens read-write without truncating
+check "printf abcdef >g; sh -c 'printf XY >&3' 3<>g; cat g"    'XYcdef'
+check "printf 'l1\nl2\n' >g; sh -c 'read l <&3; echo \$l' 3<>g" 'l1'
+check "sh -c 'echo new >&3' 3<>g; cat g"                       'new'
+
+[ $fail = 0 ] && echo "redirect: ok"
+exit $fail
@@ -0,0 +1,39 @@
+#!/bin/sh
+# timeout DURATION cmd and timeout DURATION %n end the job with status 124;
+# -k GRACE escalates to SIGKILL for a job that ignores SIGTERM.
+# usage: tests/timeout.sh path/to/myshell
+sh_under_test=$(realpath "${1:-build/myshell}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+fail=0
+
+check() {
+    got=$(cd "$dir" && "$sh_under_test" -c "$1" 2>&1)
+    if [ "$got" != "$2" ]; then
+        printf 'FAIL: %s\n  expected: %s\n  got:      %s\n' "$1" "$2" "$got"
+        fail=1
+    fi
+}
+
+# a foreground line
+check 'timeout 100ms sleep 5; echo $?'                          '124'
+check 'timeout 0.1 sleep 5 | cat; echo $?'                      '124'
+check 'timeout 5 sh -c "exit 3"; echo $?'                       '3'
+check 'timeout 5s true; echo $?'                                '0'
+# a running job: timeout returns at once, the job ends with 124
+check 'sleep 5 & timeout 100ms %1; echo $?; wait %1; echo $?'   '0
+124'
+check 'sleep 5 & timeout 100ms %1; sleep 0.3; jobs -l | grep -c "timed out"; wait' '1'
+check 'timeout 100ms %3; echo $?'                               'timeout: %3: no such job
+1'
+# SIGTERM is ignored (and so is it by sleep, which inherits that): only the
+# SIGKILL GRACE later ends the job, long before the 30s sleep would
+start=$(date +%s)
+check "timeout -k 100ms 100ms sh -c 'trap \"\" TERM; sleep 30'; echo \$?" '124'
+if [ $(($(date +%s) - start)) -ge 10 ]; then
+    echo 'FAIL: timeout -k did not kill the job'
+    fail=1
+fi
+
+[ $fail = 0 ] && echo "timeout: ok"
+exit $fail
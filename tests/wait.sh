@@ -0,0 +1,38 @@
+#!/bin/sh
+# wait on background jobs with different exit statuses: every job, one job,
+# -n (first to finish) and --timeout (124).
+# usage: tests/wait.sh path/to/myshell
+sh_under_test=$(realpath "${1:-build/myshell}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+fail=0
+
+check() {
+    got=$(cd "$dir" && "$sh_under_test" -c "$1" 2>&1)
+    if [ "$got" != "$2" ]; then
+        printf 'FAIL: %s\n  expected: %s\n  got:      %s\n' "$1" "$2" "$got"
+        fail=1
+    fi
+}
+
+# job n's status, in any order, including a job that already finished
+check 'sh -c "exit 3" & sh -c "sleep 0.2; exit 5" & wait %2; echo $?; wait %1; echo $?' '5
+3'
+# several operands: the last one's status
+check 'sh -c "exit 4" & sh -c "exit 6" & wait %1 %2; echo $?'     '6'
+# no operands: every job, status 0
+check 'sh -c "exit 4" & sh -c "sleep 0.1; exit 6" & wait; echo $?' '0'
+# -n: the first job to finish, then the next, then 127 when none are left
+check 'sh -c "sleep 0.3; exit 3" & sh -c "sleep 0.1; exit 5" & wait -n; echo $?; wait -n; echo $?; wait -n; echo $?' '5
+3
+127'
+# a job that is not there
+check 'wait %9; echo $?'                                           'wait: %9: no such job
+127'
+# --timeout: 124 while the job still runs, its status once it is done
+check 'sh -c "sleep 0.5; exit 7" & wait --timeout 0.1 %1; echo $?; wait --timeout 0.1; echo $?; wait --timeout 5 %1; echo $?' '124
+124
+7'
+
+[ $fail = 0 ] && echo "wait: ok"
+exit $fail